@@ -13,3 +13,10 @@ set LIB_DIR=/LIBPATH:.\
 set DEFINES=/D_CRT_SECURE_NO_WARNINGS
 
 cl %CFLAGS% %INC_DIR% %SRCS% %OUT_DIR% %DEFINES% /link %LFLAGS% %LIB_DIR% %LIBS%
+
+rem Demo with the render thread, images, windows and the screen compiler (ui_demo -compile)
+set DEMO=ui_demo
+set DEMO_SRCS=main.c
+set DEMO_OUT_DIR=/Fo..\build\ /Fe..\build\%DEMO% /Fm..\build\ /Fd..\build\
+
+cl %CFLAGS% %INC_DIR% %DEMO_SRCS% %DEMO_OUT_DIR% %DEFINES% /link %LFLAGS% %LIB_DIR% %LIBS%
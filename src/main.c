@@ -1,9 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <math.h>
+#include <float.h>
 #include <assert.h>
 #include <Windows.h>
 #include <GL\gl.h>
+#include <intrin.h>
+#include <immintrin.h>
 
 #define TRUE 1
 #define FALSE 0
@@ -30,8 +35,59 @@ typedef double   UI_f64;
 typedef BOOL (WINAPI * PFNWGLSWAPINTERVALEXTPROC) (int interval);
 static PFNWGLSWAPINTERVALEXTPROC wglSwapIntervalEXT;
 
+/* OpenGL 2.0 entry points used by the primitive shader */
+typedef char GLchar;
+#define GL_FRAGMENT_SHADER 0x8B30
+#define GL_VERTEX_SHADER   0x8B31
+#define GL_COMPILE_STATUS  0x8B81
+#define GL_LINK_STATUS     0x8B82
+typedef GLuint (WINAPI * PFNGLCREATESHADERPROC) (GLenum type);
+typedef void (WINAPI * PFNGLSHADERSOURCEPROC) (GLuint shader, GLsizei count, const GLchar **string, const GLint *length);
+typedef void (WINAPI * PFNGLCOMPILESHADERPROC) (GLuint shader);
+typedef void (WINAPI * PFNGLGETSHADERIVPROC) (GLuint shader, GLenum pname, GLint *params);
+typedef void (WINAPI * PFNGLGETSHADERINFOLOGPROC) (GLuint shader, GLsizei size, GLsizei *length, GLchar *log);
+typedef GLuint (WINAPI * PFNGLCREATEPROGRAMPROC) (void);
+typedef void (WINAPI * PFNGLATTACHSHADERPROC) (GLuint program, GLuint shader);
+typedef void (WINAPI * PFNGLBINDATTRIBLOCATIONPROC) (GLuint program, GLuint index, const GLchar *name);
+typedef void (WINAPI * PFNGLLINKPROGRAMPROC) (GLuint program);
+typedef void (WINAPI * PFNGLGETPROGRAMIVPROC) (GLuint program, GLenum pname, GLint *params);
+typedef void (WINAPI * PFNGLUSEPROGRAMPROC) (GLuint program);
+typedef void (WINAPI * PFNGLVERTEXATTRIBPOINTERPROC) (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer);
+typedef void (WINAPI * PFNGLENABLEVERTEXATTRIBARRAYPROC) (GLuint index);
+typedef void (WINAPI * PFNGLDISABLEVERTEXATTRIBARRAYPROC) (GLuint index);
+static PFNGLCREATESHADERPROC glCreateShader;
+static PFNGLSHADERSOURCEPROC glShaderSource;
+static PFNGLCOMPILESHADERPROC glCompileShader;
+static PFNGLGETSHADERIVPROC glGetShaderiv;
+static PFNGLGETSHADERINFOLOGPROC glGetShaderInfoLog;
+static PFNGLCREATEPROGRAMPROC glCreateProgram;
+static PFNGLATTACHSHADERPROC glAttachShader;
+static PFNGLBINDATTRIBLOCATIONPROC glBindAttribLocation;
+static PFNGLLINKPROGRAMPROC glLinkProgram;
+static PFNGLGETPROGRAMIVPROC glGetProgramiv;
+static PFNGLUSEPROGRAMPROC glUseProgram;
+static PFNGLVERTEXATTRIBPOINTERPROC glVertexAttribPointer;
+static PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArray;
+static PFNGLDISABLEVERTEXATTRIBARRAYPROC glDisableVertexAttribArray;
+
+/* Framebuffer objects for the window layers, OpenGL 3.0 or ARB_framebuffer_object */
+#define GL_FRAMEBUFFER          0x8D40
+#define GL_COLOR_ATTACHMENT0    0x8CE0
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+typedef void (WINAPI * PFNGLGENFRAMEBUFFERSPROC) (GLsizei n, GLuint *framebuffers);
+typedef void (WINAPI * PFNGLDELETEFRAMEBUFFERSPROC) (GLsizei n, const GLuint *framebuffers);
+typedef void (WINAPI * PFNGLBINDFRAMEBUFFERPROC) (GLenum target, GLuint framebuffer);
+typedef void (WINAPI * PFNGLFRAMEBUFFERTEXTURE2DPROC) (GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+typedef GLenum (WINAPI * PFNGLCHECKFRAMEBUFFERSTATUSPROC) (GLenum target);
+static PFNGLGENFRAMEBUFFERSPROC glGenFramebuffers;
+static PFNGLDELETEFRAMEBUFFERSPROC glDeleteFramebuffers;
+static PFNGLBINDFRAMEBUFFERPROC glBindFramebuffer;
+static PFNGLFRAMEBUFFERTEXTURE2DPROC glFramebufferTexture2D;
+static PFNGLCHECKFRAMEBUFFERSTATUSPROC glCheckFramebufferStatus;
+
 /* Global Appication state */
 static HGLRC global_gl_context;
+static GLuint global_prim_program;
 static unsigned int global_running;
 
 inline UI_i32 ui_i32_max(UI_i32 a, UI_i32 b) {
@@ -39,6 +95,16 @@ inline UI_i32 ui_i32_max(UI_i32 a, UI_i32 b) {
     return result;
 };
 
+inline UI_i32 ui_i32_min(UI_i32 a, UI_i32 b) {
+    UI_i32 result = a < b ? a : b;
+    return result;
+};
+
+inline UI_i32 ui_i32_abs(UI_i32 a) {
+    UI_i32 result = a < 0 ? -a : a;
+    return result;
+};
+
 typedef struct UI_V4f {
     UI_f32 x;
     UI_f32 y;
@@ -71,38 +137,66 @@ inline UI_V2i v2i_sub(UI_V2i a, UI_V2i b) {
     return result;
 }
 
-typedef struct UI_Triangle {
-    UI_V2i v[3];
-} UI_Triangle;
-
-typedef struct UI_RectMesh {
-    UI_Triangle t[2];
-} UI_RectMesh;
-
-UI_RectMesh ui_rect_get_mesh(UI_V2i pos, UI_V2i dim) {
-    UI_RectMesh result;
-    /* Setup first triangle */
-    result.t[0].v[0] = pos;
-    result.t[0].v[1].x = pos.x;
-    result.t[0].v[1].y = pos.y + dim.y;
-    result.t[0].v[2].x = pos.x + dim.x;
-    result.t[0].v[2].y = pos.y;
-    /* Setup seconds triangle */
-    result.t[1].v[0].x = pos.x + dim.x;
-    result.t[1].v[0].y = pos.y;
-    result.t[1].v[1].x = pos.x;
-    result.t[1].v[1].y = pos.y + dim.y;
-    result.t[1].v[2] = v2i_add(pos, dim);
-
-    return result;
-}
+typedef enum UI_DrawCmmdType {
+    UI_DRAW_CMMD_RECT,
+    UI_DRAW_CMMD_ROUNDED_RECT,
+    UI_DRAW_CMMD_BORDER,
+    UI_DRAW_CMMD_LINE,
+    UI_DRAW_CMMD_IMAGE,
+    UI_DRAW_CMMD_LAYER, /* composites a cached window layer, only created by the render thread */
+    UI_DRAW_CMMD_GLYPH,
+} UI_DrawCmmdType;
 
+/* NOTE: pos, dim and color must stay the first 32 bytes, the SIMD quad kernels load them directly.
+   pos and dim are always the bounding box of the primitive, the coverage inside of it is
+   evaluated analytically in the fragment shader from the primitive parameters */
 typedef struct UI_DrawCmmd {
     UI_V2i pos;
     UI_V2i dim;
     UI_V4f color;
+    /* Primitive parameters */
+    UI_DrawCmmdType type;
+    UI_f32 radius;    /* corner radius for rects, half thickness for lines */
+    UI_f32 thickness; /* border stroke width */
+    UI_u32 texture;   /* layer texture, or the texture of the image, 0 if it has to be uploaded */
+    UI_V2i a;         /* line end points */
+    UI_V2i b;
+    struct UI_ImageEntry *image; /* the backend uploads the decoded pixels straight from the cache */
+    UI_u32 glyph;     /* character of a UI_DRAW_CMMD_GLYPH, its cell in the font atlas */
+    UI_u32 padding;
 } UI_DrawCmmd;
 
+/* Quad expansion kernel: every draw command becomes 4 vertices, 4 colors and 6 indices.
+   The best implementation for the running cpu is selected in ui_init */
+typedef void (* UI_QUADS_EXPAND_PROC) (UI_DrawCmmd *cmmds, UI_u64 count, UI_u32 base_vertex,
+                                       UI_V2i *vertices, UI_V4f *colors, UI_u32 *indices);
+static UI_QUADS_EXPAND_PROC ui_quads_expand;
+/* Checks every kernel against the scalar one and times them, from main */
+#ifndef UI_QUADS_BENCHMARK
+#define UI_QUADS_BENCHMARK 0
+#endif
+
+/* Widget ids are 64 bit hashes mixed with the seed on top of the id stack */
+typedef UI_u64 UI_Id;
+
+#define UI_ID_STACK_MAX 64
+
+/* FNV-1a of a string literal as one expression, UI_ID("name") == ui_id_string("name"). An
+   optimized build folds it to a constant, the /Od build in build.bat evaluates it on every call
+   (64 unrolled steps, no loop over the string). Literals longer than 64 characters do not compile */
+#define UI__ID_C(s, i) ((i) < sizeof(s) - 1 ? (UI_u64)(UI_u8)(s)[(i) % sizeof(s)] : 0ull)
+#define UI__ID_P(s, i) ((i) < sizeof(s) - 1 ? 1099511628211ull : 1ull)
+#define UI__ID_1(s, i, h) (((h) ^ UI__ID_C(s, i)) * UI__ID_P(s, i))
+#define UI__ID_4(s, i, h) UI__ID_1(s, (i) + 3, UI__ID_1(s, (i) + 2, UI__ID_1(s, (i) + 1, UI__ID_1(s, i, h))))
+#define UI__ID_16(s, i, h) UI__ID_4(s, (i) + 12, UI__ID_4(s, (i) + 8, UI__ID_4(s, (i) + 4, UI__ID_4(s, i, h))))
+#define UI__ID_64(s, h) UI__ID_16(s, 48, UI__ID_16(s, 32, UI__ID_16(s, 16, UI__ID_16(s, 0, h))))
+#define UI_ID(s) ((UI_Id)(UI__ID_64(s, 14695981039346656037ull) + 0*sizeof(char[sizeof(s) <= 65 ? 1 : -1])))
+
+typedef struct UI_RegistrySlot {
+    UI_Id id;
+    void *value;
+} UI_RegistrySlot;
+
 typedef enum UI_WidgetType {
     UI_WIDGET_BUTTON,
     UI_WIDGET_CHECKBOX,
@@ -110,29 +204,575 @@ typedef enum UI_WidgetType {
 } UI_WidgetType;
 
 typedef struct UI_Widget {
-    void *id;
+    UI_Id id;
     UI_WidgetType type;
     struct UI_Widget *next;
 } UI_Widget;
 
 typedef struct UI_Window {
-    void *id;
+    UI_Id id;
     UI_V2i pos;
     UI_V2i dim;
-    UI_V2i widget_offset; 
+    UI_V2i size; /* set by resizing, 0 fits the content */
     struct UI_Window *next;
     struct UI_Widget *widget_first;
+    UI_u32 z; /* slot in the z-order array */
+    /* Commands of the last emitted frame, copied as they are while the content does not change */
+    UI_b32 dirty;
+    UI_V2i cmmds_dim;
+    struct UI_DrawCmmd *cmmds;
+    UI_u32 cmmd_count;
+    UI_u32 cmmd_capacity;
+    UI_u64 cmmds_hash;
 } UI_Window;
 
+/* Windows are drawn back to front from the z-order array. Raising a window appends it and
+   leaves a hole in its old slot, the holes are squeezed out once they outnumber the windows */
+#define UI_WINDOW_ORDER_MIN 64
+#define UI_WINDOW_GRIP 12 /* resize grip in the bottom right corner */
+#define UI_WINDOW_DIM_MIN 40
+/* Extra windows added by the demo, one of them is raised every frame */
+#ifndef UI_WINDOW_BENCHMARK
+#define UI_WINDOW_BENCHMARK 0
+#endif
+
+typedef enum UI_ImageState {
+    UI_IMAGE_NONE,     /* not requested or evicted */
+    UI_IMAGE_QUEUED,   /* waiting for or being decoded by a worker */
+    UI_IMAGE_READY,    /* decoded pixels available, no texture yet */
+    UI_IMAGE_UPLOADED, /* texture created, pixels released */
+    UI_IMAGE_FAILED,
+} UI_ImageState;
+
+/* Ownership: the UI thread owns every field except while a decode worker holds the entry
+   (state UI_IMAGE_QUEUED), then the worker writes pixels, width and height and publishes them
+   with state. The render thread only reads pixels, width and height of a UI_IMAGE_READY entry
+   drawn without a texture, it never writes the entry. The texture it creates goes back to the
+   UI thread in the draw list (uploads) */
+typedef struct UI_ImageEntry {
+    UI_u64 key;
+    char path[MAX_PATH];
+    volatile LONG state;
+    UI_u8 *pixels; /* RGBA8, top-down rows */
+    UI_i32 width;
+    UI_i32 height;
+    GLuint texture;
+    UI_u64 texture_frame; /* frame the texture came back in, older lists may still upload the pixels */
+    UI_u64 bytes;
+    UI_u64 last_used_frame;
+    UI_b32 resident;
+    struct UI_ImageEntry *lru_prev;
+    struct UI_ImageEntry *lru_next;
+} UI_ImageEntry;
+
+/* Monospace font rasterized by GDI into a 16x16 grid of cells, one per character.
+   The atlas goes through the image upload path like any decoded image */
+#define UI_FONT_NAME "Consolas"
+#define UI_FONT_HEIGHT 16
+
+typedef struct UI_Font {
+    UI_ImageEntry atlas;
+    UI_i32 glyph_width;
+    UI_i32 glyph_height;
+} UI_Font;
+
+#define UI_IMAGE_CACHE_MAX 4096
+#define UI_IMAGE_KEY_EMPTY 0
+#define UI_IMAGE_KEY_TOMBSTONE 1 /* evicted, lookups probe past it and inserts reuse it */
+#define UI_IMAGE_QUEUE_MAX 2048
+#define UI_IMAGE_WORKER_MAX 8
+#define UI_IMAGE_UPLOADS_PER_FRAME 16
+/* Icons requested all at once by the demo at startup, every frame of the burst is timed */
+#ifndef UI_IMAGE_BENCHMARK
+#define UI_IMAGE_BENCHMARK 0
+#endif
+
+typedef struct UI_ImageCache {
+    /* Open addressing table keyed on the path hash, evicted entries leave a tombstone */
+    UI_ImageEntry *entries;
+    /* Resident images, most recently used first */
+    UI_ImageEntry *lru_first;
+    UI_ImageEntry *lru_last;
+    UI_u64 bytes;
+    UI_u64 budget;
+    UI_u64 frame;
+    UI_u32 uploads_this_frame;
+    /* Decode job queue shared with the workers */
+    CRITICAL_SECTION lock;
+    HANDLE semaphore;
+    UI_ImageEntry *queue[UI_IMAGE_QUEUE_MAX];
+    UI_u32 queue_read;
+    UI_u32 queue_count;
+    volatile LONG running;
+    HANDLE workers[UI_IMAGE_WORKER_MAX];
+    UI_u32 worker_count;
+} UI_ImageCache;
+
+/* Text edit, the document is a list of blocks and every block is a small gap buffer with
+   the line starts inside of it. An edit moves the gap of one block and updates the prefix
+   sums of the blocks after it, so it costs the same next to the last edit or 50 MB away */
+#define UI_TEXT_BLOCK_SIZE (64*1024)
+#define UI_TEXT_BLOCK_FILL (UI_TEXT_BLOCK_SIZE - 4*1024) /* text put in a block on load */
+#define UI_TEXT_EDIT_PADDING 4
+
+typedef struct UI_TextBlock {
+    UI_u8 *data; /* UI_TEXT_BLOCK_SIZE bytes */
+    UI_u32 gap_start;
+    UI_u32 gap_end;
+    UI_u32 *lines; /* offset after every new line of the block, ascending */
+    UI_u32 line_count;
+    UI_u32 line_capacity;
+} UI_TextBlock;
+
+typedef struct UI_TextEdit {
+    UI_TextBlock *blocks;
+    UI_u64 *block_offsets; /* text before every block, block_count + 1 entries */
+    UI_u64 *block_lines;   /* new lines before every block, block_count + 1 entries */
+    UI_u64 block_count;
+    UI_u64 block_capacity;
+    UI_u64 last_block; /* block of the last lookup, text is read in runs */
+    UI_u64 cursor;
+    UI_u64 scroll_line;
+    UI_u64 scroll_column;
+} UI_TextEdit;
+
+/* Time series plot. Every pyramid level keeps the min and max of 8 entries of the level
+   below, so the min and max of any sample range is found in O(8*levels) steps and a
+   frame costs O(pixels) however many samples are visible */
+#define UI_PLOT_LEVEL_SHIFT 3
+#define UI_PLOT_LEVEL_MAX 8 /* the top level covers 8^8 = 16M samples per entry */
+#define UI_PLOT_CAPACITY_MIN 4096
+
+typedef struct UI_PlotRange {
+    UI_f32 min;
+    UI_f32 max;
+} UI_PlotRange;
+
+typedef struct UI_Plot {
+    UI_f32 *samples;
+    UI_u64 count;
+    UI_u64 capacity;
+    UI_PlotRange *levels[UI_PLOT_LEVEL_MAX]; /* levels[l] covers 8^(l + 1) samples per entry */
+    /* View, in samples. A view that reaches the last sample follows the appended samples */
+    UI_f64 view_first;
+    UI_f64 view_count; /* 0 shows the whole series */
+    UI_i32 drag_x;
+} UI_Plot;
+
+/* Value histogram of a plot built by a deferred job, the widget draws the last finished one */
+#define UI_HISTOGRAM_BINS 64
+#define UI_HISTOGRAM_SLICE (128*1024) /* samples per job slice */
+
+typedef struct UI_Histogram {
+    UI_Plot *plot;
+    UI_u32 bins[UI_HISTOGRAM_BINS]; /* last finished */
+    UI_PlotRange range;
+    UI_u64 source_count; /* samples counted in bins */
+    UI_u32 work[UI_HISTOGRAM_BINS]; /* being built by the job */
+    UI_PlotRange work_range;
+    UI_u64 work_next;
+    UI_u64 work_count;
+} UI_Histogram;
+
+/* Keyboard events queued by the platform layer, consumed by the focused widget */
+#define UI_KEY_QUEUE_MAX 256
+
+typedef enum UI_KeyEventType {
+    UI_KEY_EVENT_CHAR, /* code is the character from WM_CHAR */
+    UI_KEY_EVENT_KEY,  /* code is the virtual key from WM_KEYDOWN */
+} UI_KeyEventType;
+
+typedef struct UI_KeyEvent {
+    UI_KeyEventType type;
+    UI_u32 code;
+} UI_KeyEvent;
+
+/* Snapshot of the registry, windows and widgets written on quit and memory mapped on
+   startup. Pointers are stored as offsets from the start of the file (0 is null) and
+   are relocated in the copy on write view. Relocating writes every window, widget and
+   used registry slot, so loading reads and copies about every page of the file: it is
+   O(size) like reading the file, what it saves is building the widgets again */
+#define UI_SNAPSHOT_PATH "ui_snapshot.bin"
+#define UI_SNAPSHOT_MAGIC 0x313050414E534955ull /* "UISNAP01" */
+/* Widgets built by the demo at startup without and with a snapshot of them */
+#ifndef UI_SNAPSHOT_BENCHMARK
+#define UI_SNAPSHOT_BENCHMARK 0
+#endif
+
+typedef struct UI_SnapshotHeader {
+    UI_u64 magic;
+    /* Struct sizes of the writer, a snapshot from a different build is ignored */
+    UI_u32 window_size;
+    UI_u32 widget_size;
+    UI_u32 slot_size;
+    UI_u32 window_count;
+    UI_u32 widget_count;
+    UI_u32 padding;
+    UI_u64 registry_capacity;
+    UI_u64 registry_count;
+    UI_u64 window_first;
+    UI_u64 windows_offset;
+    UI_u64 widgets_offset;
+    UI_u64 registry_offset;
+} UI_SnapshotHeader;
+
+/* Screens: a declarative description of windows, containers, widgets and styles compiled
+   offline ("ui_demo -compile screen.ui screen.uib", ui_demo is built from this file) into a
+   flat blob. Nodes are stored in pre-order with the size of their subtree, text is an offset
+   into the string table, so the runtime maps the file and walks it without parsing or
+   relocating anything */
+#define UI_SCREEN_MAGIC 0x3130425553434955ull /* "UISCRB01" */
+#define UI_SCREEN_STYLE_MAX 64
+#define UI_SCREEN_DEPTH_MAX 32
+/* Compiles and loads a generated screen with this many containers from main */
+#ifndef UI_SCREEN_BENCHMARK
+#define UI_SCREEN_BENCHMARK 0
+#endif
+
+typedef enum UI_ScreenNodeType {
+    UI_SCREEN_WINDOW,    /* top level only, holds buttons */
+    UI_SCREEN_CONTAINER, /* stacks its children in a column or a row over a styled panel */
+    UI_SCREEN_BUTTON,
+    UI_SCREEN_CHECKBOX,
+    UI_SCREEN_SLIDER,
+    UI_SCREEN_LABEL,
+    UI_SCREEN_NODE_TYPE_COUNT,
+} UI_ScreenNodeType;
+
+typedef enum UI_ScreenLayout {
+    UI_SCREEN_COLUMN,
+    UI_SCREEN_ROW,
+} UI_ScreenLayout;
+
+typedef struct UI_ScreenNode {
+    UI_Id id;       /* hash of the name, UI_ID("name") */
+    UI_u16 type;
+    UI_u16 style;   /* 0 is the default style */
+    UI_u32 size;    /* nodes in the subtree, this one included */
+    UI_V2i pos;     /* top level nodes, the others are placed by their container */
+    UI_u32 text;    /* offset in the string table, 0 is the empty string */
+    UI_u32 layout;
+} UI_ScreenNode;
+
+typedef struct UI_ScreenStyle {
+    UI_V4f color;
+    UI_V4f text_color;
+    UI_f32 radius;
+    UI_i32 padding;
+    UI_i32 spacing;
+    UI_u32 padding_;
+} UI_ScreenStyle;
+
+typedef struct UI_ScreenHeader {
+    UI_u64 magic;
+    UI_u32 node_size;
+    UI_u32 style_size;
+    UI_u32 node_count;
+    UI_u32 style_count;
+    UI_u64 nodes_offset;
+    UI_u64 styles_offset;
+    UI_u64 strings_offset;
+    UI_u64 strings_size;
+} UI_ScreenHeader;
+
+/* Per node state of a loaded screen, the blob itself is read only */
+typedef struct UI_ScreenValue {
+    UI_V2i pos;
+    UI_V2i dim;
+    UI_b32 pressed; /* button clicked this frame */
+    UI_b32 checked;
+    float value;
+    UI_u32 padding;
+} UI_ScreenValue;
+
+typedef struct UI_Screen {
+    UI_u8 *base;
+    UI_u64 size;
+    HANDLE file;
+    HANDLE mapping;
+    UI_ScreenNode *nodes;
+    UI_ScreenStyle *styles;
+    char *strings;
+    UI_u32 node_count;
+    UI_u32 style_count;
+    UI_ScreenValue *values;
+} UI_Screen;
+
+/* Lock-free ring of fixed size elements from worker threads to the UI thread. Every slot
+   carries a sequence number: a producer claims the slot at head (with a compare exchange
+   when there are several producers), writes it and publishes it by bumping its sequence.
+   The UI thread drains the published slots once per frame */
+typedef struct UI_Channel {
+    volatile LONG64 head; /* next slot to claim, written by the producers */
+    UI_u8 head_padding[56];
+    volatile LONG64 tail; /* next slot to read, written by the UI thread */
+    UI_u8 tail_padding[56];
+    volatile LONG64 *sequence; /* slot i is readable when its sequence is tail + 1 */
+    UI_u8 *data;
+    UI_u64 element_size;
+    UI_u64 mask; /* capacity - 1, the capacity is a power of two */
+    UI_b32 multi_producer;
+    volatile LONG64 dropped; /* pushes refused because the ring was full */
+} UI_Channel;
+
+/* Latest value from one producer thread in three copies, the same exchange as the render
+   pipe: the producer writes the back copy and swaps it with the middle one, the UI thread
+   swaps the middle one with the front one when it is fresh. Nobody waits and the UI
+   always reads a complete value */
+#define UI_CELL_FRESH 0x4
+
+typedef struct UI_ValueCell {
+    UI_u8 *data;
+    UI_u64 element_size;
+    UI_u32 back;  /* owned by the producer */
+    UI_u32 front; /* owned by the UI thread */
+    volatile LONG middle; /* plus UI_CELL_FRESH while the UI thread has not picked it up */
+    UI_u64 read_frame; /* the front copy is taken once per frame, every reader sees the same value */
+} UI_ValueCell;
+
+/* Placement of the elements of a widget array: row major on a grid of widget sized cells
+   separated by spacing, columns 0 is a single column */
+typedef struct UI_ArrayLayout {
+    UI_V2i pos;
+    UI_V2i spacing;
+    UI_u32 columns;
+} UI_ArrayLayout;
+
+/* Times 1000 sliders per widget and through ui_slider_array from main */
+#ifndef UI_WIDGET_ARRAY_BENCHMARK
+#define UI_WIDGET_ARRAY_BENCHMARK 0
+#endif
+
+/* Frame scheduler: starts the frame as late as possible before the next present
+   and measures the latency from the oldest input event to the present. A frame is only
+   built when something changed: input, a redraw request, a pending job or new data in a
+   channel or cell that a widget read in the last frame */
+#define UI_LATENCY_BUCKET_COUNT 64 /* 1 ms per bucket, the last one collects everything above */
+#define UI_WATCH_MAX 256
+
+/* Present timing, owned by the thread that renders. Every list it presents carries a copy
+   back to the UI thread, which updates its own from the lists it gets back */
+typedef struct UI_PresentClock {
+    UI_i64 last_present;
+    UI_f64 frame_period; /* seconds, measured between presents */
+    UI_f64 render_cost;  /* seconds, fast rise and slow decay of the backend submission time */
+} UI_PresentClock;
+
+typedef struct UI_FrameScheduler {
+    UI_i64 frequency;
+    UI_i64 last_present; /* from the newest presented list the UI thread got back */
+    UI_f64 frame_period;
+    UI_f64 build_cost;   /* seconds, fast rise and slow decay of the measured build time */
+    UI_f64 render_cost;
+    UI_i64 build_begin;
+    UI_i64 pending_input; /* oldest input event not consumed by a frame, 0 if none */
+    UI_i64 frame_input;   /* oldest input event consumed by the frame being built */
+    /* Written only by the thread that renders, read once it has been joined */
+    UI_u64 latency_histogram[UI_LATENCY_BUCKET_COUNT];
+    UI_u64 latency_count;
+    UI_i64 init_time;
+    UI_b32 first_frame_reported;
+    UI_b32 redraw; /* requested while building the last frame or by the window procedure */
+    UI_Channel *watched_channels[UI_WATCH_MAX];
+    UI_u32 watched_channel_count;
+    UI_ValueCell *watched_cells[UI_WATCH_MAX];
+    UI_u32 watched_cell_count;
+    UI_u64 frames_skipped;
+} UI_FrameScheduler;
+
+/* Deferred work: expensive widget work is split in jobs that run one slice at a time after
+   the frame is built. Slices stop when the per frame budget or the frame deadline is reached
+   and the rest of the work carries over to the next frame */
+#define UI_JOB_MAX 64
+#ifndef UI_JOB_BUDGET_MS
+#define UI_JOB_BUDGET_MS 4.0
+#endif
+
+/* Does a bounded amount of work, returns TRUE once the job is finished */
+typedef UI_b32 UI_JobStep(void *data);
+
+typedef struct UI_Job {
+    UI_Id id;
+    UI_JobStep *step;
+    void *data;
+    UI_i64 submit_time;
+} UI_Job;
+
+typedef struct UI_JobQueue {
+    UI_Job jobs[UI_JOB_MAX];
+    UI_u32 count;
+    UI_u32 next;   /* round robin, every job gets a slice before any gets a second one */
+    UI_f64 budget; /* seconds per frame */
+    /* Metrics */
+    UI_u64 frames;       /* frames that ran at least one slice */
+    UI_u64 slices;
+    UI_u64 completed;
+    UI_f64 time;         /* seconds spent in slices */
+    UI_u64 overruns;     /* frames where the last slice ended past the limit */
+    UI_f64 overrun_time; /* seconds past the limit, summed */
+    UI_f64 overrun_max;
+    UI_f64 latency_max;  /* seconds from submit to finish */
+} UI_JobQueue;
+
+/* Pipelined rendering: the UI thread builds frame N+1 into one draw list while the render
+   thread expands, submits and presents frame N from another. The lists are exchanged with a
+   lock-free triple buffer so neither side ever waits for the other */
+#ifndef UI_RENDER_THREAD
+#define UI_RENDER_THREAD 1 /* 0 builds and renders back to back on the UI thread */
+#endif
+/* Artificial per frame load of each stage in milliseconds, to measure the pipeline */
+#ifndef UI_DEBUG_BUILD_LOAD_MS
+#define UI_DEBUG_BUILD_LOAD_MS 0
+#endif
+#ifndef UI_DEBUG_RENDER_LOAD_MS
+#define UI_DEBUG_RENDER_LOAD_MS 0
+#endif
+
+#define UI_DRAW_CMMD_BUFFER_MAX 16384 /* a screen of text is a few thousand glyphs */
+/* Times filling the draw list with rects through each emission path from main */
+#ifndef UI_DRAW_BENCHMARK
+#define UI_DRAW_BENCHMARK 0
+#endif
+#define UI_RENDER_LIST_COUNT 3
+#define UI_RENDER_FRESH 0x4 /* set in ready while the list it names has not been picked up */
+#define UI_RENDER_RETIRE_MAX 256
+#define UI_RENDER_UPLOAD_MAX 32 /* UI_IMAGE_UPLOADS_PER_FRAME images plus the font atlas */
+#define UI_RENDER_LAYER_MAX 512
+#define UI_LAYER_CACHE_MAX 512
+#define UI_LAYER_KEEP_FRAMES 120 /* a layer not composited for this many frames is released */
+
+/* A window's commands, in coordinates relative to the window, composited at pos */
+typedef struct UI_DrawLayer {
+    UI_Id id;
+    UI_V2i pos;
+    UI_V2i dim;
+    UI_u64 first;
+    UI_u64 count;
+    UI_u64 hash; /* content hash of the commands and the size, a match means the cache is valid */
+} UI_DrawLayer;
+
+/* Offscreen copy of a window layer with premultiplied alpha, owned by the render thread */
+typedef struct UI_Layer {
+    UI_Id id;
+    UI_V2i dim;
+    UI_u64 hash;
+    UI_u64 last_used;
+    GLuint texture;
+    GLuint framebuffer;
+} UI_Layer;
+
+typedef struct UI_DrawList {
+    UI_DrawCmmd cmmds[UI_DRAW_CMMD_BUFFER_MAX];
+    UI_u64 count;
+    UI_u64 frame;        /* image cache frame the list was built in */
+    UI_i64 frame_input;  /* oldest input event consumed by the frame, 0 if none */
+    UI_i64 publish_time;
+    /* Textures of evicted images, deleted by the render thread when it picks up the list.
+       A list that is dropped without being rendered keeps them for the next frame built in it */
+    GLuint retired[UI_RENDER_RETIRE_MAX];
+    UI_u32 retired_count;
+    /* Textures the render thread created for images drawn without one, the other way around.
+       The UI thread hands them to the entries when it gets the list back */
+    struct UI_ImageEntry *upload_images[UI_RENDER_UPLOAD_MAX];
+    UI_u64 upload_keys[UI_RENDER_UPLOAD_MAX]; /* the slot may hold another image by then */
+    GLuint uploads[UI_RENDER_UPLOAD_MAX];
+    UI_u32 upload_count;
+    /* Window layers in z-order, commands outside of every layer are drawn straight to the frame */
+    UI_DrawLayer layers[UI_RENDER_LAYER_MAX];
+    UI_u32 layer_count;
+    /* Present timing of the render thread after it presented the list */
+    UI_PresentClock clock;
+    UI_b32 presented;
+} UI_DrawList;
+
+typedef struct UI_RenderPipe {
+    UI_DrawList lists[UI_RENDER_LIST_COUNT];
+    UI_u32 build_index;  /* owned by the UI thread */
+    UI_u32 render_index; /* owned by the render thread */
+    volatile LONG ready; /* index of the newest complete list plus UI_RENDER_FRESH */
+    volatile LONG64 render_frame; /* frame of the list being rendered, older images are free to evict */
+    /* Written by the window procedure, applied by the render thread */
+    volatile LONG width;
+    volatile LONG height;
+    LONG viewport_width;
+    LONG viewport_height;
+    HWND window;
+    HANDLE thread;
+    HANDLE wake;
+    volatile LONG running;
+    UI_Layer layer_cache[UI_LAYER_CACHE_MAX];
+    UI_u32 layer_cache_count;
+    UI_PresentClock clock; /* owned by the render thread */
+    /* Stats */
+    UI_i64 start_time;
+    UI_u64 frames_built;
+    UI_u64 frames_dropped;
+    UI_u64 frames_presented;
+    UI_f64 publish_to_present; /* seconds, summed over the presented frames */
+    UI_u64 layer_hits;
+    UI_u64 layer_renders;
+} UI_RenderPipe;
+
+/* Linear arena of malloc'd blocks. Reset gives every block back at once and keeps them for
+   the next round, so after warming up a frame does not allocate */
+#define UI_ARENA_BLOCK_SIZE (1024*1024)
+#define UI_ARENA_ALIGN 16
+/* Poisons released memory and prints the frame arena usage, only of the frames that set a new
+   maximum, a frame that stays under the high-water mark prints nothing */
+#ifndef UI_ARENA_DEBUG
+#define UI_ARENA_DEBUG 0
+#endif
+#define UI_ARENA_POISON 0xdd
+
+typedef struct UI_ArenaBlock {
+    struct UI_ArenaBlock *next;
+    UI_u64 size;
+    UI_u64 used;
+    UI_u64 padding; /* keeps the data that follows aligned */
+} UI_ArenaBlock;
+
+typedef struct UI_Arena {
+    UI_ArenaBlock *first;
+    UI_ArenaBlock *last;
+    UI_ArenaBlock *current;
+    UI_u64 used;       /* bytes handed out since the last reset */
+    UI_u64 high_water; /* most bytes handed out between two resets */
+} UI_Arena;
+
 typedef struct UI_State {
     /* Widget */
-    void *active;
-    void *hot;
-    void *hover;
-    void *next_hover;
+    UI_Id active;
+    UI_Id hot;
+    UI_Id hover;
+    UI_Id next_hover;
 
     UI_Window *window_first;
     UI_Window *window_current;
+    UI_Window **window_order; /* back to front, 0 is a hole */
+    UI_u32 window_order_count;
+    UI_u32 window_order_capacity;
+    UI_u32 window_order_holes;
+    UI_Window *window_hover; /* front window under the mouse in the last frame */
+    UI_Window *window_grabbed;
+    UI_V2i window_grab; /* mouse minus the window position or size */
+    UI_b32 window_resizing;
+    UI_u64 window_emits;
+    UI_u64 window_copies;
+    UI_f64 window_time; /* seconds spent in the window render pass */
+    UI_u64 window_frames;
+
+    /* Ids */
+    UI_Id id_stack[UI_ID_STACK_MAX];
+    UI_u32 id_stack_count;
+    UI_RegistrySlot *registry;
+    UI_u64 registry_capacity;
+    UI_u64 registry_count;
+
+    /* Mapped snapshot, windows, widgets and the registry may live inside of it */
+    UI_u8 *snapshot;
+    UI_u64 snapshot_size;
+    HANDLE snapshot_file;
+    HANDLE snapshot_mapping;
     
     /* Input */
     UI_V2i mouse;
@@ -140,15 +780,38 @@ typedef struct UI_State {
     UI_b32 mouse_is_up;
     UI_b32 mouse_went_down;
     UI_b32 mouse_went_up;
+    UI_i32 mouse_wheel; /* WHEEL_DELTA units this frame, positive away from the user */
+    UI_Id focus;        /* widget that receives the keyboard events */
+    UI_KeyEvent key_queue[UI_KEY_QUEUE_MAX];
+    UI_u32 key_queue_count;
+
+    /* Frame data: labels, scratch and anything else that does not outlive the frame. Memory
+       pushed while building a frame stays valid until the end of the next one */
+    UI_Arena frame_arenas[2];
+    UI_u32 frame_arena_index;
+    UI_u64 frame_high_water; /* most bytes a single frame pushed */
+    UI_u64 frame;
 } UI_State;
 
 /* Global UI library state */
 
-#define UI_DRAW_CMMD_BUFFER_MAX 1024
-static struct UI_DrawCmmd draw_cmmd_buffer[UI_DRAW_CMMD_BUFFER_MAX];
-static UI_u64 draw_cmmd_buffer_count;
+/* Expanded vertex streams, only touched by the thread that renders */
+static UI_V2i draw_vertex_buffer[UI_DRAW_CMMD_BUFFER_MAX*4];
+static UI_V4f draw_color_buffer[UI_DRAW_CMMD_BUFFER_MAX*4];
+static UI_u32 draw_index_buffer[UI_DRAW_CMMD_BUFFER_MAX*6];
+static UI_V4f draw_shape_buffer[UI_DRAW_CMMD_BUFFER_MAX*4];
+static UI_V4f draw_param_buffer[UI_DRAW_CMMD_BUFFER_MAX*4];
+
+/* Generic attribute locations of the primitive shader (6 and 7 do not alias any fixed function array) */
+#define UI_PRIM_ATTRIB_SHAPE 6
+#define UI_PRIM_ATTRIB_PARAM 7
 
 static UI_State ui_state;
+static UI_ImageCache ui_image_cache;
+static UI_Font ui_font;
+static UI_FrameScheduler ui_scheduler;
+static UI_JobQueue ui_jobs;
+static UI_RenderPipe ui_render;
 static UI_V2i ui_default_button_dim = {100, 50};
 static UI_V4f ui_default_button_color = {0.4f, 0.4f, 0.4f, 1.0f};
 static UI_V2i ui_default_checkbox_dim = {25, 25};
@@ -158,225 +821,2466 @@ static UI_V2i ui_default_window_margin = {10, 10};
 static UI_V4f ui_default_window_color = {0.9f, 0.9f, 0.9f, 1.0f};
 
 /* ------------------------------------------------------------------------ */
+/* Frame scheduler */
 
-LRESULT ui_win32_get_input(HWND window, UINT message, WPARAM wparam, LPARAM lparam) {
-    UI_b32 last_mouse_is_down = ui_state.mouse_is_down;
-    UI_b32 last_mouse_is_up = ui_state.mouse_is_up;
-    
-    LRESULT result = 0;
-    switch (message) {
-        case WM_MOUSEMOVE: {
-            ui_state.mouse.x = LOWORD(lparam);
-            ui_state.mouse.y = HIWORD(lparam);
-        } break;
-        case WM_LBUTTONUP: {
-            ui_state.mouse_is_up = TRUE;
-            ui_state.mouse_is_down = FALSE;
+inline UI_i64 ui_time_now(void) {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
 
-            ui_state.mouse_went_up = ui_state.mouse_is_up && !last_mouse_is_up;
-        } break;
-        case WM_LBUTTONDOWN: {
-            ui_state.mouse_is_down = TRUE;
-            ui_state.mouse_is_up = FALSE;
+inline UI_f64 ui_time_seconds(UI_i64 ticks) {
+    return (UI_f64)ticks / (UI_f64)ui_scheduler.frequency;
+}
 
-            ui_state.mouse_went_down = ui_state.mouse_is_down && !last_mouse_is_down;
-        } break;
-        default: {
-        } break;
-    }
-    return result;
+void ui_scheduler_init(void) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    ui_scheduler.frequency = frequency.QuadPart;
+    ui_scheduler.frame_period = 1.0/60.0;
+    ui_scheduler.last_present = ui_time_now();
+    ui_scheduler.init_time = ui_scheduler.last_present;
+    ui_scheduler.redraw = TRUE;
+    /* Make Sleep precise enough to wake up close to the deadline */
+    timeBeginPeriod(1);
 }
 
-void ui_push_draw_cmmd(UI_DrawCmmd cmmd) {
-    ASSERT(draw_cmmd_buffer_count < UI_DRAW_CMMD_BUFFER_MAX);
-    draw_cmmd_buffer[draw_cmmd_buffer_count++] = cmmd;
+void ui_scheduler_quit(void) {
+    timeEndPeriod(1);
 }
 
-void ui_push_rect(UI_V2i pos, UI_V2i dim, UI_V4f color) {
-    UI_DrawCmmd cmmd;
-    cmmd.pos = pos;
-    cmmd.dim = dim;
-    cmmd.color = color;
-    ui_push_draw_cmmd(cmmd);
+inline void ui_scheduler_input_event(void) {
+    if (!ui_scheduler.pending_input) {
+        ui_scheduler.pending_input = ui_time_now();
+    }
+}
+
+/* Input sitting in the queue is stamped now. The wait runs this before and during its sleep,
+   stamping input only when it is dispatched after the sleep would hide the time it waited */
+inline void ui_scheduler_poll_input(void) {
+    if (HIWORD(GetQueueStatus(QS_INPUT))) {
+        ui_scheduler_input_event();
+    }
 }
 
-UI_Widget *ui_widget_get(UI_Window *window, void *id) {
-    UI_Widget *widget = window->widget_first;
-    while (widget) {
-        if (widget->id == id) {
-            return widget;
+/* Wait until the latest point where the frame can still be built before the next present */
+void ui_scheduler_wait(void) {
+    UI_f64 margin = 0.001;
+    UI_f64 cost = ui_scheduler.build_cost + ui_scheduler.render_cost;
+    UI_f64 start = ui_scheduler.frame_period - cost*1.5 - margin;
+    UI_i64 period = (UI_i64)(ui_scheduler.frame_period*(UI_f64)ui_scheduler.frequency);
+    UI_i64 deadline = ui_scheduler.last_present + (UI_i64)(start*(UI_f64)ui_scheduler.frequency);
+    /* With a render thread the present happens later, build at most one frame per present */
+    while (period > 0 && deadline <= ui_scheduler.build_begin + period/2) {
+        deadline += period;
+    }
+    UI_i64 now = ui_time_now();
+    ui_scheduler_poll_input();
+    while (now < deadline) {
+        UI_f64 remaining = ui_time_seconds(deadline - now);
+        if (remaining > 0.002) {
+            /* New input wakes the thread up to be stamped, then it sleeps on to the deadline */
+            MsgWaitForMultipleObjects(0, 0, FALSE, (DWORD)((remaining - 0.001)*1000.0), QS_INPUT);
+        } else {
+            YieldProcessor();
         }
-        widget = widget->next;
+        ui_scheduler_poll_input();
+        now = ui_time_now();
     }
-    return 0;
 }
 
-UI_Widget *ui_widget_register(UI_Window *window, void *id, UI_WidgetType type) {
-    UI_Widget *widget = (UI_Widget *)malloc(sizeof(UI_Widget));
-    memset(widget, 0, sizeof(UI_Widget));
-    widget->id = id;
-    widget->type = type;
-    widget->next = window->widget_first;
-    window->widget_first = widget;
-    return widget;
+void ui_scheduler_begin_build(void) {
+    ui_scheduler.build_begin = ui_time_now();
+    ui_scheduler.frame_input = ui_scheduler.pending_input;
+    ui_scheduler.pending_input = 0;
+    ui_scheduler.redraw = FALSE;
+    ui_scheduler.watched_channel_count = 0;
+    ui_scheduler.watched_cell_count = 0;
 }
 
-UI_Window *ui_window_get(void *id) {
-    UI_Window *window = ui_state.window_first;
-    while (window) {
-        if (window->id == id) {
-            return window;
+/* Builds the next frame even if there is no input */
+inline void ui_request_redraw(void) {
+    ui_scheduler.redraw = TRUE;
+}
+
+/* Widgets that read a channel or a cell watch it, new data in it builds the next frame */
+void ui_watch_channel(UI_Channel *channel) {
+    for (UI_u32 i = 0; i < ui_scheduler.watched_channel_count; ++i) {
+        if (ui_scheduler.watched_channels[i] == channel) {
+            return;
         }
-        window = window->next;
     }
-    return 0;
+    if (ui_scheduler.watched_channel_count < UI_WATCH_MAX) {
+        ui_scheduler.watched_channels[ui_scheduler.watched_channel_count++] = channel;
+    } else {
+        ui_request_redraw();
+    }
 }
 
-UI_Window *ui_window_register(void *id) {
-    UI_Window *window = (UI_Window *)malloc(sizeof(UI_Window));
-    memset(window, 0, sizeof(UI_Window));
-    window->id = id;
-    window->next = ui_state.window_first;
-    ui_state.window_first = window;
-    return window;
+void ui_watch_cell(UI_ValueCell *cell) {
+    for (UI_u32 i = 0; i < ui_scheduler.watched_cell_count; ++i) {
+        if (ui_scheduler.watched_cells[i] == cell) {
+            return;
+        }
+    }
+    if (ui_scheduler.watched_cell_count < UI_WATCH_MAX) {
+        ui_scheduler.watched_cells[ui_scheduler.watched_cell_count++] = cell;
+    } else {
+        ui_request_redraw();
+    }
 }
 
-UI_b32 ui_mouse_inside_rect(UI_V2i pos, UI_V2i dim) {
-    UI_b32 result = ui_state.mouse.x >= pos.x && ui_state.mouse.x < (pos.x + dim.x) &&
-        ui_state.mouse.y >= pos.y && ui_state.mouse.y < (pos.y + dim.y);
-    return result;
+UI_b32 ui_channel_ready(UI_Channel *channel);
+UI_b32 ui_cell_fresh(UI_ValueCell *cell);
+
+UI_b32 ui_scheduler_frame_needed(void) {
+    if (ui_scheduler.redraw || ui_scheduler.pending_input || ui_jobs.count) {
+        return TRUE;
+    }
+    for (UI_u32 i = 0; i < ui_scheduler.watched_channel_count; ++i) {
+        if (ui_channel_ready(ui_scheduler.watched_channels[i])) {
+            return TRUE;
+        }
+    }
+    for (UI_u32 i = 0; i < ui_scheduler.watched_cell_count; ++i) {
+        if (ui_cell_fresh(ui_scheduler.watched_cells[i])) {
+            return TRUE;
+        }
+    }
+    return FALSE;
 }
 
-inline void ui_set_hot(void *id) {
-    if (!ui_state.active) {
-        ui_state.hot = id;
+/* Nothing changed, the last presented frame stays on screen. The wait aims for the next period */
+void ui_scheduler_skip_frame(void) {
+    ui_scheduler.build_begin = ui_time_now();
+    ++ui_scheduler.frames_skipped;
+}
+
+/* Fast rise so a slow frame moves the deadline at once, slow decay so it does not jitter */
+inline void ui_scheduler_track_cost(UI_f64 *average, UI_f64 cost) {
+    if (cost > *average) {
+        *average = cost;
+    } else {
+        *average = *average*0.95 + cost*0.05;
     }
 }
 
-inline void ui_set_active(void *id) {
-    ui_state.active = id;
+void ui_scheduler_end_build(void) {
+    ui_scheduler_track_cost(&ui_scheduler.build_cost, ui_time_seconds(ui_time_now() - ui_scheduler.build_begin));
 }
 
-inline void ui_set_next_hover(void *id) {
-    ui_state.next_hover = id;
+/* Called by the thread that renders with its clock and the input timestamp the presented
+   frame consumed */
+void ui_scheduler_present(UI_PresentClock *clock, UI_i64 frame_input) {
+    UI_i64 now = ui_time_now();
+    UI_f64 period = ui_time_seconds(now - clock->last_present);
+    /* Ignore hitches and repeated presents so one bad frame does not move the deadline */
+    if (period > 1.0/240.0 && period < 1.0/15.0) {
+        clock->frame_period = clock->frame_period*0.9 + period*0.1;
+    }
+    clock->last_present = now;
+    if (!ui_scheduler.first_frame_reported) {
+        printf("time to first frame: %.2f ms\n", ui_time_seconds(now - ui_scheduler.init_time)*1000.0);
+        ui_scheduler.first_frame_reported = TRUE;
+    }
+    if (frame_input) {
+        UI_u64 bucket = (UI_u64)(ui_time_seconds(now - frame_input)*1000.0);
+        if (bucket >= UI_LATENCY_BUCKET_COUNT) {
+            bucket = UI_LATENCY_BUCKET_COUNT - 1;
+        }
+        ++ui_scheduler.latency_histogram[bucket];
+        ++ui_scheduler.latency_count;
+    }
 }
 
-inline UI_b32 ui_is_hot(void *id) {
-    return ui_state.hot == id;
+void ui_scheduler_print_latency(void) {
+    printf("frames skipped with nothing to update: %llu\n", ui_scheduler.frames_skipped);
+    printf("input to present latency (%llu frames with input)\n", ui_scheduler.latency_count);
+    for (UI_u32 i = 0; i < UI_LATENCY_BUCKET_COUNT; ++i) {
+        if (ui_scheduler.latency_histogram[i]) {
+            printf("  %2u ms%s: %llu\n", i, (i == UI_LATENCY_BUCKET_COUNT - 1) ? "+" : " ",
+                   ui_scheduler.latency_histogram[i]);
+        }
+    }
 }
 
-inline UI_b32 ui_is_active(void *id) {
-    return ui_state.active == id;
+/* Latest time this frame can be published and still make the next present */
+UI_i64 ui_scheduler_frame_deadline(void) {
+    UI_f64 margin = 0.001;
+    UI_i64 period = (UI_i64)(ui_scheduler.frame_period*(UI_f64)ui_scheduler.frequency);
+    UI_f64 end = ui_scheduler.frame_period - ui_scheduler.render_cost - margin;
+    UI_i64 deadline = ui_scheduler.last_present + (UI_i64)(end*(UI_f64)ui_scheduler.frequency);
+    while (period > 0 && deadline <= ui_scheduler.build_begin) {
+        deadline += period;
+    }
+    return deadline;
 }
 
-inline UI_b32 ui_is_hover(void *id) {
-    return ui_state.hover == id;
+/* ------------------------------------------------------------------------ */
+/* Deferred jobs */
+
+void ui_jobs_init(void) {
+    ui_jobs.budget = UI_JOB_BUDGET_MS*0.001;
 }
 
-void ui_init(void) {
-    /* TODO: initialize ui_state */
+void ui_jobs_set_budget(UI_f64 milliseconds) {
+    ui_jobs.budget = milliseconds*0.001;
 }
 
-void ui_quit(void) {
-    UI_Window *window = ui_state.window_first;
-    while(window) {
-        UI_Widget *widget = window->widget_first;
-        while(widget) {
-            void *to_free = widget;
-            widget = widget->next;
-            free(to_free);
+UI_b32 ui_job_pending(UI_Id id) {
+    for (UI_u32 i = 0; i < ui_jobs.count; ++i) {
+        if (ui_jobs.jobs[i].id == id) {
+            return TRUE;
         }
-        void *to_free = window;
-        window = window->next;
-        free(to_free);
     }
+    return FALSE;
 }
 
-void ui_update(void) {
-    /* UI update pass */
-    UI_Window *window = ui_state.window_first;
-    while (window) {
-        window->dim = v2i(0, (ui_default_window_margin.y));
-        window->widget_offset = v2i(0, 0); /* TODO: This state can be temporal */
-        UI_Widget *widget = window->widget_first; 
-        while (widget) {
-            switch (widget->type) {
-                case UI_WIDGET_BUTTON: {
-                    window->dim.x = ui_i32_max(window->dim.x, ui_default_button_dim.x + (ui_default_window_margin.x * 2));
-                    window->dim.y += ui_default_button_dim.y + ui_default_window_margin.y;
-                } break;
-                case UI_WIDGET_CHECKBOX: {
-                } break;
-                case UI_WIDGET_SLIDER: {
-                } break;
-                default: {
-                    INVALID_CODE_PATH();
-                } break;
-            }
-            widget = widget->next;
-        }
-        window = window->next;
+/* Returns FALSE if a job with the same id is still running or the queue is full */
+UI_b32 ui_job_submit(UI_Id id, UI_JobStep *step, void *data) {
+    if (ui_jobs.count == UI_JOB_MAX || ui_job_pending(id)) {
+        return FALSE;
     }
+    UI_Job *job = ui_jobs.jobs + ui_jobs.count++;
+    job->id = id;
+    job->step = step;
+    job->data = data;
+    job->submit_time = ui_time_now();
+    return TRUE;
+}
 
-    /* UI render pass */
-    window = ui_state.window_first;
-    while (window) {
-        ui_push_rect(window->pos, window->dim, ui_default_window_color);
-        UI_Widget *widget = window->widget_first;
-        while(widget) {
-            switch (widget->type) {
-                case UI_WIDGET_BUTTON: {
-                    UI_V2i pos = v2i_add(window->widget_offset, ui_default_window_margin);
-                    ui_push_rect(v2i_add(window->pos, pos), ui_default_button_dim, ui_default_button_color);
-                    window->widget_offset.y += ui_default_button_dim.y + ui_default_window_margin.y;
-                } break;
-                case UI_WIDGET_CHECKBOX: {
-                } break;
-                case UI_WIDGET_SLIDER: {
-                } break;
-                default: {
-                    INVALID_CODE_PATH();
-                } break;
-            }
-            widget = widget->next;
+/* Runs slices until the budget or the frame deadline is used up. At least one slice runs
+   every frame so the jobs make progress even when the frame itself is late */
+void ui_jobs_run(void) {
+    if (!ui_jobs.count) {
+        return;
+    }
+    UI_i64 begin = ui_time_now();
+    UI_i64 limit = begin + (UI_i64)(ui_jobs.budget*(UI_f64)ui_scheduler.frequency);
+    UI_i64 deadline = ui_scheduler_frame_deadline();
+    limit = deadline < limit ? deadline : limit;
+    UI_i64 now = begin;
+    do {
+        if (ui_jobs.next >= ui_jobs.count) {
+            ui_jobs.next = 0;
         }
-        window = window->next;
+        UI_Job *job = ui_jobs.jobs + ui_jobs.next;
+        UI_b32 finished = job->step(job->data);
+        now = ui_time_now();
+        ++ui_jobs.slices;
+        if (finished) {
+            UI_f64 latency = ui_time_seconds(now - job->submit_time);
+            ui_jobs.latency_max = latency > ui_jobs.latency_max ? latency : ui_jobs.latency_max;
+            ++ui_jobs.completed;
+            /* The finished result is only drawn by the next frame */
+            ui_request_redraw();
+            /* Keeps the order of the other jobs, the next one slides into this slot */
+            memmove(job, job + 1, (ui_jobs.count - ui_jobs.next - 1)*sizeof(UI_Job));
+            --ui_jobs.count;
+        } else {
+            ++ui_jobs.next;
+        }
+    } while (ui_jobs.count && now < limit);
+    ui_jobs.time += ui_time_seconds(now - begin);
+    ++ui_jobs.frames;
+    if (now > limit) {
+        UI_f64 overrun = ui_time_seconds(now - limit);
+        ++ui_jobs.overruns;
+        ui_jobs.overrun_time += overrun;
+        ui_jobs.overrun_max = overrun > ui_jobs.overrun_max ? overrun : ui_jobs.overrun_max;
     }
+}
 
-    /* ------------------------------------------------ */
+void ui_jobs_print_metrics(void) {
+    printf("deferred jobs (budget %.2f ms per frame)\n", ui_jobs.budget*1000.0);
+    printf("  %llu completed, %llu slices over %llu frames, %.2f ms per frame\n",
+           ui_jobs.completed, ui_jobs.slices, ui_jobs.frames,
+           ui_jobs.frames ? ui_jobs.time*1000.0/(UI_f64)ui_jobs.frames : 0.0);
+    printf("  budget overruns: %llu frames, %.2f ms average, %.2f ms worst\n", ui_jobs.overruns,
+           ui_jobs.overruns ? ui_jobs.overrun_time*1000.0/(UI_f64)ui_jobs.overruns : 0.0, ui_jobs.overrun_max*1000.0);
+    printf("  submit to finish: %.2f ms worst\n", ui_jobs.latency_max*1000.0);
+}
 
-    /* TODO: See how to update frame information */
-    ui_state.mouse_went_down = FALSE;
-    ui_state.mouse_went_up = FALSE;
-    /* TODO: Check if next_hover = 0 is necessary */
-    ui_state.hover = ui_state.next_hover;
-    ui_state.next_hover = 0;
+/* ------------------------------------------------------------------------ */
+/* Channels and value cells */
+
+void ui_channel_init(UI_Channel *channel, UI_u64 element_size, UI_u64 capacity, UI_b32 multi_producer) {
+    ASSERT(capacity && (capacity & (capacity - 1)) == 0);
+    memset(channel, 0, sizeof(UI_Channel));
+    channel->sequence = (volatile LONG64 *)malloc(capacity*sizeof(LONG64));
+    channel->data = (UI_u8 *)malloc(capacity*element_size);
+    if (!channel->sequence || !channel->data) {
+        printf("Error: Cannot allocate channel of %llu elements\n", capacity);
+        exit(-1);
+    }
+    for (UI_u64 i = 0; i < capacity; ++i) {
+        channel->sequence[i] = (LONG64)i;
+    }
+    channel->element_size = element_size;
+    channel->mask = capacity - 1;
+    channel->multi_producer = multi_producer;
 }
 
-void ui_begin_window(void *id, int x, int y) {
-    UI_Window *window = ui_window_get(id);
-    if (!window) {
-        /* Initialize window */
-        window = ui_window_register(id);
-        window->pos.x = x;
-        window->pos.y = y;
+void ui_channel_free(UI_Channel *channel) {
+    free((void *)channel->sequence);
+    free(channel->data);
+    memset(channel, 0, sizeof(UI_Channel));
+}
+
+/* Any thread for a multi producer channel, one thread otherwise. Never blocks, returns
+   FALSE when the ring is full */
+UI_b32 ui_channel_push(UI_Channel *channel, void *value) {
+    LONG64 head = channel->head;
+    for (;;) {
+        LONG64 sequence = channel->sequence[head & channel->mask];
+        if (sequence < head) {
+            InterlockedIncrement64(&channel->dropped);
+            return FALSE;
+        }
+        if (sequence > head) {
+            /* Another producer claimed the slot, try again from the new head */
+            head = channel->head;
+            continue;
+        }
+        if (!channel->multi_producer) {
+            channel->head = head + 1;
+            break;
+        }
+        LONG64 previous = InterlockedCompareExchange64(&channel->head, head + 1, head);
+        if (previous == head) {
+            break;
+        }
+        head = previous;
     }
-    ui_state.window_current = window;
-    /* TODO: Implemets window logic */
+    memcpy(channel->data + (head & channel->mask)*channel->element_size, value, channel->element_size);
+    InterlockedExchange64(channel->sequence + (head & channel->mask), head + 1);
+    return TRUE;
 }
-void ui_end_window(void) {
-    ui_state.window_current = 0;
+
+/* UI thread only */
+UI_b32 ui_channel_ready(UI_Channel *channel) {
+    LONG64 tail = channel->tail;
+    return channel->sequence[tail & channel->mask] == tail + 1;
 }
 
-UI_b32 ui_button(void *id, char *name, int x, int y) {
+UI_b32 ui_channel_pop(UI_Channel *channel, void *value) {
+    LONG64 tail = channel->tail;
+    volatile LONG64 *sequence = channel->sequence + (tail & channel->mask);
+    if (*sequence != tail + 1) {
+        return FALSE;
+    }
+    memcpy(value, channel->data + (tail & channel->mask)*channel->element_size, channel->element_size);
+    /* Hands the slot back to the producers for the next lap of the ring */
+    InterlockedExchange64(sequence, tail + (LONG64)channel->mask + 1);
+    channel->tail = tail + 1;
+    return TRUE;
+}
 
-    /* Widget dimensions:
-    If the widget is not iside the window x and y are abs coordinates.
-    Uf the widget is inside a window x and y are coordiantes relative to that window. */
-    UI_V2i pos = v2i(x, y);
-    UI_V2i dim = ui_default_button_dim;
-    UI_V4f color = v4f(0.4f, 0.4f, 0.4f, 1.0f);
-    UI_b32 result = FALSE;
+/* Pops up to count elements, returns how many */
+UI_u64 ui_channel_drain(UI_Channel *channel, void *values, UI_u64 count) {
+    UI_u64 popped = 0;
+    UI_u8 *at = (UI_u8 *)values;
+    while (popped < count && ui_channel_pop(channel, at)) {
+        at += channel->element_size;
+        ++popped;
+    }
+    return popped;
+}
+
+void ui_cell_init(UI_ValueCell *cell, UI_u64 element_size, void *initial) {
+    memset(cell, 0, sizeof(UI_ValueCell));
+    cell->data = (UI_u8 *)malloc(element_size*3);
+    if (!cell->data) {
+        printf("Error: Cannot allocate value cell\n");
+        exit(-1);
+    }
+    for (UI_u32 i = 0; i < 3; ++i) {
+        memcpy(cell->data + i*element_size, initial, element_size);
+    }
+    cell->element_size = element_size;
+    cell->front = 0;
+    cell->middle = 1;
+    cell->back = 2;
+    cell->read_frame = (UI_u64)-1;
+}
+
+void ui_cell_free(UI_ValueCell *cell) {
+    free(cell->data);
+    memset(cell, 0, sizeof(UI_ValueCell));
+}
+
+/* Producer thread, a value the UI has not picked up yet is replaced */
+void ui_cell_publish(UI_ValueCell *cell, void *value) {
+    memcpy(cell->data + cell->back*cell->element_size, value, cell->element_size);
+    LONG previous = InterlockedExchange(&cell->middle, (LONG)cell->back | UI_CELL_FRESH);
+    cell->back = (UI_u32)(previous & ~UI_CELL_FRESH);
+}
+
+UI_b32 ui_cell_fresh(UI_ValueCell *cell) {
+    return (cell->middle & UI_CELL_FRESH) != 0;
+}
+
+/* UI thread, takes the newest value once per frame and watches the cell. The copy stays
+   valid and writable until the next frame */
+void *ui_cell_latest(UI_ValueCell *cell) {
+    if (cell->read_frame != ui_state.frame) {
+        cell->read_frame = ui_state.frame;
+        if (ui_cell_fresh(cell)) {
+            LONG previous = InterlockedExchange(&cell->middle, (LONG)cell->front);
+            cell->front = (UI_u32)(previous & ~UI_CELL_FRESH);
+        }
+    }
+    ui_watch_cell(cell);
+    return cell->data + cell->front*cell->element_size;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Arenas */
+
+void *ui_arena_push(UI_Arena *arena, UI_u64 size) {
+    size = (size + (UI_ARENA_ALIGN - 1)) & ~(UI_u64)(UI_ARENA_ALIGN - 1);
+    UI_ArenaBlock *block = arena->current;
+    /* Blocks after the current one are empty, they were kept from an earlier round */
+    while (block && block->used + size > block->size) {
+        block = block->next;
+    }
+    if (!block) {
+        UI_u64 block_size = size > UI_ARENA_BLOCK_SIZE ? size : UI_ARENA_BLOCK_SIZE;
+        block = (UI_ArenaBlock *)malloc(sizeof(UI_ArenaBlock) + block_size);
+        if (!block) {
+            printf("Error: Cannot allocate arena block of %llu bytes\n", block_size);
+            exit(-1);
+        }
+        block->next = 0;
+        block->size = block_size;
+        block->used = 0;
+        if (arena->last) {
+            arena->last->next = block;
+        } else {
+            arena->first = block;
+        }
+        arena->last = block;
+    }
+    arena->current = block;
+    void *result = (UI_u8 *)(block + 1) + block->used;
+    block->used += size;
+    arena->used += size;
+    return result;
+}
+
+void ui_arena_reset(UI_Arena *arena) {
+    for (UI_ArenaBlock *block = arena->first; block; block = block->next) {
+#if UI_ARENA_DEBUG
+        memset(block + 1, UI_ARENA_POISON, block->used);
+#endif
+        block->used = 0;
+    }
+    arena->high_water = arena->used > arena->high_water ? arena->used : arena->high_water;
+    arena->used = 0;
+    arena->current = arena->first;
+}
+
+void ui_arena_free(UI_Arena *arena) {
+    UI_ArenaBlock *block = arena->first;
+    while (block) {
+        UI_ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    memset(arena, 0, sizeof(UI_Arena));
+}
+
+inline UI_Arena *ui_frame_arena(void) {
+    return ui_state.frame_arenas + ui_state.frame_arena_index;
+}
+
+inline void *ui_frame_push(UI_u64 size) {
+    return ui_arena_push(ui_frame_arena(), size);
+}
+
+/* printf into the frame arena, for labels built every frame */
+char *ui_frame_format(char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(0, 0, format, args);
+    va_end(args);
+    if (length < 0) {
+        length = 0;
+    }
+    char *result = (char *)ui_frame_push((UI_u64)length + 1);
+    va_start(args, format);
+    vsnprintf(result, (size_t)length + 1, format, args);
+    va_end(args);
+    result[length] = 0;
+    return result;
+}
+
+/* Ends the frame: the arena of the frame before the one just built is reset and becomes
+   the arena of the next frame */
+void ui_frame_arena_flip(void) {
+    UI_Arena *built = ui_frame_arena();
+    if (built->used > ui_state.frame_high_water) {
+        ui_state.frame_high_water = built->used;
+#if UI_ARENA_DEBUG
+        printf("frame %llu: new arena maximum %llu bytes\n", ui_state.frame, built->used);
+#endif
+    }
+    ui_state.frame_arena_index ^= 1;
+    ui_arena_reset(ui_frame_arena());
+}
+
+/* ------------------------------------------------------------------------ */
+/* Widget ids */
+
+UI_u64 ui_hash_string(char *string) {
+    /* FNV-1a */
+    UI_u64 hash = 14695981039346656037ull;
+    while (*string) {
+        hash ^= (UI_u8)*string++;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+UI_u64 ui_hash_bytes(void *data, UI_u64 size, UI_u64 hash) {
+    /* FNV-1a, continues from the given hash */
+    UI_u8 *bytes = (UI_u8 *)data;
+    for (UI_u64 i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline UI_u64 ui_hash_u64(UI_u64 x) {
+    /* splitmix64 finalizer */
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+inline UI_Id ui_id_string(char *string) {
+    return ui_hash_string(string);
+}
+
+inline UI_Id ui_id_int(UI_i64 value) {
+    return ui_hash_u64((UI_u64)value);
+}
+
+inline UI_Id ui_id_ptr(void *ptr) {
+    return ui_hash_u64((UI_u64)(uintptr_t)ptr);
+}
+
+/* Mix a key with the seed on top of the id stack, 0 is reserved for "no widget" */
+UI_Id ui_id_resolve(UI_Id key) {
+    UI_Id seed = ui_state.id_stack_count ? ui_state.id_stack[ui_state.id_stack_count - 1] : 0;
+    UI_Id id = ui_hash_u64(seed ^ (key + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2)));
+    return id ? id : 1;
+}
+
+void ui_push_id(UI_Id key) {
+    ASSERT(ui_state.id_stack_count < UI_ID_STACK_MAX);
+    UI_Id id = ui_id_resolve(key);
+    ui_state.id_stack[ui_state.id_stack_count++] = id;
+}
+
+void ui_pop_id(void) {
+    ASSERT(ui_state.id_stack_count > 0);
+    --ui_state.id_stack_count;
+}
+
+/* Open addressing table from resolved ids to windows and widgets. The ids are
+   already well mixed hashes so they index the table directly */
+/* Objects loaded from the snapshot live in the mapped file and are not freed */
+inline UI_b32 ui_snapshot_owns(void *ptr) {
+    UI_u8 *p = (UI_u8 *)ptr;
+    return ui_state.snapshot && p >= ui_state.snapshot && p < ui_state.snapshot + ui_state.snapshot_size;
+}
+
+UI_u64 ui_registry_slot(UI_Id id) {
+    UI_u64 mask = ui_state.registry_capacity - 1;
+    UI_u64 i = id & mask;
+    while (ui_state.registry[i].id != id && ui_state.registry[i].id != 0) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+void *ui_registry_get(UI_Id id) {
+    if (!ui_state.registry) {
+        return 0;
+    }
+    return ui_state.registry[ui_registry_slot(id)].value;
+}
+
+void ui_registry_put(UI_Id id, void *value) {
+    if ((ui_state.registry_count + 1)*10 > ui_state.registry_capacity*7) {
+        UI_RegistrySlot *old_registry = ui_state.registry;
+        UI_u64 old_capacity = ui_state.registry_capacity;
+        ui_state.registry_capacity = old_capacity ? old_capacity*2 : 256;
+        ui_state.registry = (UI_RegistrySlot *)malloc(sizeof(UI_RegistrySlot)*ui_state.registry_capacity);
+        memset(ui_state.registry, 0, sizeof(UI_RegistrySlot)*ui_state.registry_capacity);
+        ui_state.registry_count = 0;
+        for (UI_u64 i = 0; i < old_capacity; ++i) {
+            if (old_registry[i].id) {
+                ui_registry_put(old_registry[i].id, old_registry[i].value);
+            }
+        }
+        if (!ui_snapshot_owns(old_registry)) {
+            free(old_registry);
+        }
+    }
+    UI_u64 mask = ui_state.registry_capacity - 1;
+    for (UI_u64 i = id & mask;; i = (i + 1) & mask) {
+        UI_RegistrySlot *slot = ui_state.registry + i;
+        if (slot->id == id || slot->id == 0) {
+            if (slot->id == 0) {
+                ++ui_state.registry_count;
+            }
+            slot->id = id;
+            slot->value = value;
+            return;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+
+LRESULT ui_win32_get_input(HWND window, UINT message, WPARAM wparam, LPARAM lparam) {
+    UI_b32 last_mouse_is_down = ui_state.mouse_is_down;
+    UI_b32 last_mouse_is_up = ui_state.mouse_is_up;
+    
+    LRESULT result = 0;
+    switch (message) {
+        case WM_MOUSEMOVE: {
+            ui_scheduler_input_event();
+            ui_state.mouse.x = LOWORD(lparam);
+            ui_state.mouse.y = HIWORD(lparam);
+        } break;
+        case WM_LBUTTONUP: {
+            ui_scheduler_input_event();
+            ui_state.mouse_is_up = TRUE;
+            ui_state.mouse_is_down = FALSE;
+
+            ui_state.mouse_went_up = ui_state.mouse_is_up && !last_mouse_is_up;
+        } break;
+        case WM_LBUTTONDOWN: {
+            ui_scheduler_input_event();
+            ui_state.mouse_is_down = TRUE;
+            ui_state.mouse_is_up = FALSE;
+
+            ui_state.mouse_went_down = ui_state.mouse_is_down && !last_mouse_is_down;
+        } break;
+        case WM_MOUSEWHEEL: {
+            ui_scheduler_input_event();
+            ui_state.mouse_wheel += GET_WHEEL_DELTA_WPARAM(wparam);
+        } break;
+        case WM_KEYDOWN:
+        case WM_CHAR: {
+            ui_scheduler_input_event();
+            /* Never block the platform layer, events past the end of a full queue are dropped */
+            if (ui_state.key_queue_count < UI_KEY_QUEUE_MAX) {
+                UI_KeyEvent *event = ui_state.key_queue + ui_state.key_queue_count++;
+                event->type = (message == WM_CHAR) ? UI_KEY_EVENT_CHAR : UI_KEY_EVENT_KEY;
+                event->code = (UI_u32)wparam;
+            }
+        } break;
+        default: {
+        } break;
+    }
+    return result;
+}
+
+/* Index sequence for 8 consecutive quads (quad * 4 + {0, 1, 2, 2, 1, 3}) */
+static const UI_u32 ui_quad_index_pattern[48] = {
+     0,  1,  2,  2,  1,  3,   4,  5,  6,  6,  5,  7,
+     8,  9, 10, 10,  9, 11,  12, 13, 14, 14, 13, 15,
+    16, 17, 18, 18, 17, 19,  20, 21, 22, 22, 21, 23,
+    24, 25, 26, 26, 25, 27,  28, 29, 30, 30, 29, 31,
+};
+
+void ui_quads_expand_scalar(UI_DrawCmmd *cmmds, UI_u64 count, UI_u32 base_vertex,
+                            UI_V2i *vertices, UI_V4f *colors, UI_u32 *indices) {
+    for (UI_u64 i = 0; i < count; ++i) {
+        UI_DrawCmmd *cmmd = cmmds + i;
+        UI_V2i *v = vertices + i*4;
+        UI_V4f *c = colors + i*4;
+        UI_u32 *index = indices + i*6;
+        UI_u32 base = base_vertex + (UI_u32)(i*4);
+        /* Setup vertices */
+        v[0] = cmmd->pos;
+        v[1] = v2i(cmmd->pos.x, cmmd->pos.y + cmmd->dim.y);
+        v[2] = v2i(cmmd->pos.x + cmmd->dim.x, cmmd->pos.y);
+        v[3] = v2i_add(cmmd->pos, cmmd->dim);
+        c[0] = cmmd->color;
+        c[1] = cmmd->color;
+        c[2] = cmmd->color;
+        c[3] = cmmd->color;
+        /* Setup triangles */
+        for (UI_u32 j = 0; j < 6; ++j) {
+            index[j] = base + ui_quad_index_pattern[j];
+        }
+    }
+}
+
+void ui_quads_expand_sse2(UI_DrawCmmd *cmmds, UI_u64 count, UI_u32 base_vertex,
+                          UI_V2i *vertices, UI_V4f *colors, UI_u32 *indices) {
+    /* {x, y, w, h} masks for {v0, v1} and {v2, v3} */
+    __m128i mask_lo = _mm_set_epi32(-1, 0, 0, 0);
+    __m128i mask_hi = _mm_set_epi32(-1, -1, 0, -1);
+    UI_u64 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (UI_u64 j = i; j < i + 4; ++j) {
+            __m128i a = _mm_loadu_si128((__m128i *)&cmmds[j].pos);
+            __m128i pos = _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 1, 0));
+            __m128i dim = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 2, 3, 2));
+            __m128 color = _mm_loadu_ps(&cmmds[j].color.x);
+            _mm_storeu_si128((__m128i *)(vertices + j*4 + 0), _mm_add_epi32(pos, _mm_and_si128(dim, mask_lo)));
+            _mm_storeu_si128((__m128i *)(vertices + j*4 + 2), _mm_add_epi32(pos, _mm_and_si128(dim, mask_hi)));
+            _mm_storeu_ps(&colors[j*4 + 0].x, color);
+            _mm_storeu_ps(&colors[j*4 + 1].x, color);
+            _mm_storeu_ps(&colors[j*4 + 2].x, color);
+            _mm_storeu_ps(&colors[j*4 + 3].x, color);
+        }
+        __m128i base = _mm_set1_epi32((int)(base_vertex + (UI_u32)(i*4)));
+        for (UI_u32 j = 0; j < 24; j += 4) {
+            __m128i pattern = _mm_loadu_si128((__m128i *)(ui_quad_index_pattern + j));
+            _mm_storeu_si128((__m128i *)(indices + i*6 + j), _mm_add_epi32(base, pattern));
+        }
+    }
+    ui_quads_expand_scalar(cmmds + i, count - i, base_vertex + (UI_u32)(i*4),
+                           vertices + i*4, colors + i*4, indices + i*6);
+}
+
+void ui_quads_expand_avx2(UI_DrawCmmd *cmmds, UI_u64 count, UI_u32 base_vertex,
+                          UI_V2i *vertices, UI_V4f *colors, UI_u32 *indices) {
+    __m256i mask_lo = _mm256_set_epi32(-1, 0, 0, 0, -1, 0, 0, 0);
+    __m256i mask_hi = _mm256_set_epi32(-1, -1, 0, -1, -1, -1, 0, -1);
+    UI_u64 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        /* Two commands per register, one in each 128 bit lane */
+        for (UI_u64 j = i; j < i + 8; j += 2) {
+            __m256i r0 = _mm256_loadu_si256((__m256i *)(cmmds + j + 0));
+            __m256i r1 = _mm256_loadu_si256((__m256i *)(cmmds + j + 1));
+            __m256i a = _mm256_permute2x128_si256(r0, r1, 0x20);
+            __m256i color = _mm256_permute2x128_si256(r0, r1, 0x31);
+            __m256i pos = _mm256_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256i dim = _mm256_shuffle_epi32(a, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256i lo = _mm256_add_epi32(pos, _mm256_and_si256(dim, mask_lo));
+            __m256i hi = _mm256_add_epi32(pos, _mm256_and_si256(dim, mask_hi));
+            __m256i color0 = _mm256_permute2x128_si256(color, color, 0x00);
+            __m256i color1 = _mm256_permute2x128_si256(color, color, 0x11);
+            _mm256_storeu_si256((__m256i *)(vertices + j*4 + 0), _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i *)(vertices + j*4 + 4), _mm256_permute2x128_si256(lo, hi, 0x31));
+            _mm256_storeu_si256((__m256i *)(colors + j*4 + 0), color0);
+            _mm256_storeu_si256((__m256i *)(colors + j*4 + 2), color0);
+            _mm256_storeu_si256((__m256i *)(colors + j*4 + 4), color1);
+            _mm256_storeu_si256((__m256i *)(colors + j*4 + 6), color1);
+        }
+        __m256i base = _mm256_set1_epi32((int)(base_vertex + (UI_u32)(i*4)));
+        for (UI_u32 j = 0; j < 48; j += 8) {
+            __m256i pattern = _mm256_loadu_si256((__m256i *)(ui_quad_index_pattern + j));
+            _mm256_storeu_si256((__m256i *)(indices + i*6 + j), _mm256_add_epi32(base, pattern));
+        }
+    }
+    ui_quads_expand_sse2(cmmds + i, count - i, base_vertex + (UI_u32)(i*4),
+                         vertices + i*4, colors + i*4, indices + i*6);
+}
+
+void ui_quads_init(void) {
+    int info[4];
+    ui_quads_expand = ui_quads_expand_scalar;
+    __cpuid(info, 1);
+    UI_b32 has_sse2 = (info[3] & (1 << 26)) != 0;
+    UI_b32 has_avx = (info[2] & (1 << 28)) != 0;
+    UI_b32 has_osxsave = (info[2] & (1 << 27)) != 0;
+    if (has_sse2) {
+        ui_quads_expand = ui_quads_expand_sse2;
+    }
+    /* The os must save the ymm registers before we can use avx */
+    if (has_avx && has_osxsave && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) {
+            ui_quads_expand = ui_quads_expand_avx2;
+        }
+    }
+}
+
+#if UI_QUADS_BENCHMARK
+/* Every kernel the cpu runs against the scalar one, over each tail the 8 and 4 wide loops can
+   leave and an odd, unaligned full buffer. All outputs start from the same fill so a write
+   past the end is a mismatch too. Then the time of each kernel on the full buffer */
+void ui_quads_benchmark(void) {
+    enum { full = UI_DRAW_CMMD_BUFFER_MAX - 3, tails = 17, repeats = 2000 };
+    UI_QUADS_EXPAND_PROC kernels[] = { ui_quads_expand_scalar, ui_quads_expand_sse2, ui_quads_expand_avx2 };
+    char *names[] = { "scalar", "sse2", "avx2" };
+    /* ui_quads_init only picks a kernel the cpu and the os support */
+    UI_u32 kernel_count = 1;
+    if (ui_quads_expand == ui_quads_expand_sse2) kernel_count = 2;
+    if (ui_quads_expand == ui_quads_expand_avx2) kernel_count = 3;
+    UI_DrawCmmd *cmmds = (UI_DrawCmmd *)malloc(sizeof(UI_DrawCmmd)*UI_DRAW_CMMD_BUFFER_MAX);
+    memset(cmmds, 0, sizeof(UI_DrawCmmd)*UI_DRAW_CMMD_BUFFER_MAX);
+    UI_u32 seed = 1;
+    for (UI_u32 i = 0; i < UI_DRAW_CMMD_BUFFER_MAX; ++i) {
+        seed = seed*1103515245 + 12345;
+        cmmds[i].pos = v2i((UI_i32)((seed >> 8) % 2000) - 500, (UI_i32)((seed >> 4) % 1500) - 300);
+        cmmds[i].dim = v2i((UI_i32)((seed >> 12) % 300), (UI_i32)((seed >> 16) % 200));
+        cmmds[i].color = v4f((UI_f32)(seed & 255)/255.0f, (UI_f32)((seed >> 8) & 255)/255.0f,
+                             (UI_f32)((seed >> 16) & 255)/255.0f, (UI_f32)(seed >> 24)/255.0f);
+    }
+    UI_V2i *vertices[3];
+    UI_V4f *colors[3];
+    UI_u32 *indices[3];
+    for (UI_u32 k = 0; k < 3; ++k) {
+        vertices[k] = (UI_V2i *)malloc(sizeof(UI_V2i)*UI_DRAW_CMMD_BUFFER_MAX*4);
+        colors[k] = (UI_V4f *)malloc(sizeof(UI_V4f)*UI_DRAW_CMMD_BUFFER_MAX*4);
+        indices[k] = (UI_u32 *)malloc(sizeof(UI_u32)*UI_DRAW_CMMD_BUFFER_MAX*6);
+    }
+    UI_u32 mismatches[3] = { 0, 0, 0 };
+    for (UI_u32 c = 0; c <= tails + 1; ++c) {
+        UI_u64 count = (c <= tails) ? c : full;
+        UI_DrawCmmd *first = cmmds + (c & 1);
+        for (UI_u32 k = 0; k < kernel_count; ++k) {
+            memset(vertices[k], 0xcd, sizeof(UI_V2i)*UI_DRAW_CMMD_BUFFER_MAX*4);
+            memset(colors[k], 0xcd, sizeof(UI_V4f)*UI_DRAW_CMMD_BUFFER_MAX*4);
+            memset(indices[k], 0xcd, sizeof(UI_u32)*UI_DRAW_CMMD_BUFFER_MAX*6);
+            kernels[k](first, count, c*37, vertices[k], colors[k], indices[k]);
+            if (memcmp(vertices[k], vertices[0], sizeof(UI_V2i)*UI_DRAW_CMMD_BUFFER_MAX*4) != 0 ||
+                memcmp(colors[k], colors[0], sizeof(UI_V4f)*UI_DRAW_CMMD_BUFFER_MAX*4) != 0 ||
+                memcmp(indices[k], indices[0], sizeof(UI_u32)*UI_DRAW_CMMD_BUFFER_MAX*6) != 0) {
+                ++mismatches[k];
+            }
+        }
+    }
+    for (UI_u32 k = 0; k < kernel_count; ++k) {
+        UI_i64 begin = ui_time_now();
+        for (UI_u32 r = 0; r < repeats; ++r) {
+            kernels[k](cmmds + 1, full, 0, vertices[k], colors[k], indices[k]);
+        }
+        UI_f64 us = ui_time_seconds(ui_time_now() - begin)*1000000.0/repeats;
+        printf("quads %-6s: %u of %u counts differ from scalar, %.3f us for %u commands\n", names[k],
+               mismatches[k], tails + 2, us, (UI_u32)full);
+    }
+    for (UI_u32 k = kernel_count; k < 3; ++k) {
+        printf("quads %-6s: not supported by this cpu\n", names[k]);
+    }
+    for (UI_u32 k = 0; k < 3; ++k) {
+        free(vertices[k]);
+        free(colors[k]);
+        free(indices[k]);
+    }
+    free(cmmds);
+}
+#endif
+
+/* Per vertex primitive data for the shader: shape is the rect min/max or the line
+   end points, param is {radius, thickness, type, 0} */
+void ui_prims_expand_params(UI_DrawCmmd *cmmds, UI_u64 count, UI_V4f *shapes, UI_V4f *params) {
+    for (UI_u64 i = 0; i < count; ++i) {
+        UI_DrawCmmd *cmmd = cmmds + i;
+        UI_V4f shape;
+        if (cmmd->type == UI_DRAW_CMMD_LINE) {
+            shape = v4f((UI_f32)cmmd->a.x, (UI_f32)cmmd->a.y, (UI_f32)cmmd->b.x, (UI_f32)cmmd->b.y);
+        } else {
+            shape = v4f((UI_f32)cmmd->pos.x, (UI_f32)cmmd->pos.y,
+                        (UI_f32)(cmmd->pos.x + cmmd->dim.x), (UI_f32)(cmmd->pos.y + cmmd->dim.y));
+        }
+        UI_V4f param = v4f(cmmd->radius, cmmd->thickness, (UI_f32)cmmd->type, (UI_f32)cmmd->glyph);
+        for (UI_u64 j = i*4; j < i*4 + 4; ++j) {
+            shapes[j] = shape;
+            params[j] = param;
+        }
+    }
+}
+
+/* Span of count commands at the end of the draw list after a single capacity check, the
+   caller writes every command in place. Whatever is left unwritten goes back with ui_draw_trim */
+inline UI_DrawCmmd *ui_draw_reserve(UI_u64 count) {
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    ASSERT(list->count + count <= UI_DRAW_CMMD_BUFFER_MAX);
+    UI_DrawCmmd *cmmds = list->cmmds + list->count;
+    list->count += count;
+    return cmmds;
+}
+
+/* Ends the draw list at end, a pointer inside of the last reserved span */
+inline void ui_draw_trim(UI_DrawCmmd *end) {
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    ASSERT(end >= list->cmmds && end <= list->cmmds + list->count);
+    list->count = (UI_u64)(end - list->cmmds);
+}
+
+void ui_push_draw_cmmd(UI_DrawCmmd cmmd) {
+    *ui_draw_reserve(1) = cmmd;
+}
+
+/* Writers fill one reserved command, the ui_push_ functions reserve it for them */
+inline void ui_write_rect(UI_DrawCmmd *cmmd, UI_V2i pos, UI_V2i dim, UI_V4f color) {
+    memset(cmmd, 0, sizeof(UI_DrawCmmd));
+    cmmd->type = UI_DRAW_CMMD_RECT;
+    cmmd->pos = pos;
+    cmmd->dim = dim;
+    cmmd->color = color;
+}
+
+inline void ui_write_rounded_rect(UI_DrawCmmd *cmmd, UI_V2i pos, UI_V2i dim, UI_f32 radius, UI_V4f color) {
+    memset(cmmd, 0, sizeof(UI_DrawCmmd));
+    cmmd->type = UI_DRAW_CMMD_ROUNDED_RECT;
+    cmmd->pos = pos;
+    cmmd->dim = dim;
+    cmmd->color = color;
+    cmmd->radius = radius;
+}
+
+inline void ui_write_border(UI_DrawCmmd *cmmd, UI_V2i pos, UI_V2i dim, UI_f32 radius, UI_f32 thickness, UI_V4f color) {
+    memset(cmmd, 0, sizeof(UI_DrawCmmd));
+    cmmd->type = UI_DRAW_CMMD_BORDER;
+    cmmd->pos = pos;
+    cmmd->dim = dim;
+    cmmd->color = color;
+    cmmd->radius = radius;
+    cmmd->thickness = thickness;
+}
+
+inline void ui_write_line(UI_DrawCmmd *cmmd, UI_V2i a, UI_V2i b, UI_f32 thickness, UI_V4f color) {
+    /* The bounding box is padded so the anti aliased edge and the round caps are not clipped */
+    UI_i32 pad = (UI_i32)(thickness*0.5f) + 2;
+    memset(cmmd, 0, sizeof(UI_DrawCmmd));
+    cmmd->type = UI_DRAW_CMMD_LINE;
+    cmmd->pos = v2i(ui_i32_min(a.x, b.x) - pad, ui_i32_min(a.y, b.y) - pad);
+    cmmd->dim = v2i(ui_i32_abs(b.x - a.x) + pad*2, ui_i32_abs(b.y - a.y) + pad*2);
+    cmmd->color = color;
+    cmmd->radius = thickness*0.5f;
+    cmmd->a = a;
+    cmmd->b = b;
+}
+
+inline void ui_write_glyph(UI_DrawCmmd *cmmd, UI_V2i pos, UI_u8 glyph, UI_V4f color) {
+    memset(cmmd, 0, sizeof(UI_DrawCmmd));
+    cmmd->type = UI_DRAW_CMMD_GLYPH;
+    cmmd->pos = pos;
+    cmmd->dim = v2i(ui_font.glyph_width, ui_font.glyph_height);
+    cmmd->color = color;
+    cmmd->image = &ui_font.atlas;
+    cmmd->texture = ui_font.atlas.texture;
+    cmmd->glyph = glyph;
+}
+
+void ui_push_rect(UI_V2i pos, UI_V2i dim, UI_V4f color) {
+    ui_write_rect(ui_draw_reserve(1), pos, dim, color);
+}
+
+void ui_push_rounded_rect(UI_V2i pos, UI_V2i dim, UI_f32 radius, UI_V4f color) {
+    ui_write_rounded_rect(ui_draw_reserve(1), pos, dim, radius, color);
+}
+
+void ui_push_border(UI_V2i pos, UI_V2i dim, UI_f32 radius, UI_f32 thickness, UI_V4f color) {
+    ui_write_border(ui_draw_reserve(1), pos, dim, radius, thickness, color);
+}
+
+void ui_push_line(UI_V2i a, UI_V2i b, UI_f32 thickness, UI_V4f color) {
+    ui_write_line(ui_draw_reserve(1), a, b, thickness, color);
+}
+
+void ui_push_glyph(UI_V2i pos, UI_u8 glyph, UI_V4f color) {
+    ui_write_glyph(ui_draw_reserve(1), pos, glyph, color);
+}
+
+/* Commands pushed between begin and end are relative to pos and cached in the window layer */
+UI_DrawLayer *ui_render_begin_layer(UI_Id id, UI_V2i pos, UI_V2i dim) {
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    ASSERT(list->layer_count < UI_RENDER_LAYER_MAX);
+    UI_DrawLayer *layer = list->layers + list->layer_count++;
+    layer->id = id;
+    layer->pos = pos;
+    layer->dim = dim;
+    layer->first = list->count;
+    return layer;
+}
+
+void ui_render_end_layer(UI_DrawLayer *layer) {
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    layer->count = list->count - layer->first;
+    /* The position is not part of the hash, moving a window reuses its layer */
+    UI_u64 hash = ui_hash_bytes(&layer->dim, sizeof(UI_V2i), 14695981039346656037ull);
+    layer->hash = ui_hash_bytes(list->cmmds + layer->first, layer->count*sizeof(UI_DrawCmmd), hash);
+}
+
+/* Layer from commands cached by the caller, the hash was computed when they were emitted */
+void ui_render_push_layer(UI_Id id, UI_V2i pos, UI_V2i dim, UI_DrawCmmd *cmmds, UI_u32 count, UI_u64 hash) {
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    ASSERT(list->layer_count < UI_RENDER_LAYER_MAX);
+    UI_DrawLayer *layer = list->layers + list->layer_count++;
+    layer->id = id;
+    layer->pos = pos;
+    layer->dim = dim;
+    layer->first = list->count;
+    layer->count = count;
+    layer->hash = hash;
+    memcpy(ui_draw_reserve(count), cmmds, sizeof(UI_DrawCmmd)*count);
+}
+
+UI_Widget *ui_widget_get(UI_Window *window, UI_Id id) {
+    /* Widget ids are seeded with the window id so they are unique across windows */
+    (void)window;
+    return (UI_Widget *)ui_registry_get(id);
+}
+
+UI_Widget *ui_widget_register(UI_Window *window, UI_Id id, UI_WidgetType type) {
+    UI_Widget *widget = (UI_Widget *)malloc(sizeof(UI_Widget));
+    memset(widget, 0, sizeof(UI_Widget));
+    widget->id = id;
+    widget->type = type;
+    widget->next = window->widget_first;
+    window->widget_first = widget;
+    window->dirty = TRUE;
+    ui_registry_put(id, widget);
+    return widget;
+}
+
+UI_Window *ui_window_get(UI_Id id) {
+    return (UI_Window *)ui_registry_get(id);
+}
+
+void ui_window_order_compact(void) {
+    UI_u32 count = 0;
+    for (UI_u32 i = 0; i < ui_state.window_order_count; ++i) {
+        UI_Window *window = ui_state.window_order[i];
+        if (window) {
+            window->z = count;
+            ui_state.window_order[count++] = window;
+        }
+    }
+    ui_state.window_order_count = count;
+    ui_state.window_order_holes = 0;
+}
+
+void ui_window_order_push(UI_Window *window) {
+    if (ui_state.window_order_count == ui_state.window_order_capacity) {
+        if (ui_state.window_order_holes) {
+            ui_window_order_compact();
+        } else {
+            ui_state.window_order_capacity = ui_state.window_order_capacity ? ui_state.window_order_capacity*2 : UI_WINDOW_ORDER_MIN;
+            ui_state.window_order = (UI_Window **)realloc(ui_state.window_order, sizeof(UI_Window *)*ui_state.window_order_capacity);
+            if (!ui_state.window_order) {
+                printf("Error: Cannot grow the window order to %u windows\n", ui_state.window_order_capacity);
+                exit(-1);
+            }
+        }
+    }
+    window->z = ui_state.window_order_count;
+    ui_state.window_order[ui_state.window_order_count++] = window;
+}
+
+/* O(1), amortized over the compactions */
+void ui_window_raise(UI_Window *window) {
+    if (window->z == ui_state.window_order_count - 1) {
+        return;
+    }
+    ui_state.window_order[window->z] = 0;
+    ++ui_state.window_order_holes;
+    ui_window_order_push(window);
+    if (ui_state.window_order_holes > ui_state.window_order_count - ui_state.window_order_holes) {
+        ui_window_order_compact();
+    }
+}
+
+/* The position is not part of the cached content, a move copies the same commands */
+inline void ui_window_move(UI_Window *window, UI_V2i pos) {
+    window->pos = pos;
+}
+
+inline void ui_window_resize(UI_Window *window, UI_V2i size) {
+    window->size = v2i(ui_i32_max(size.x, UI_WINDOW_DIM_MIN), ui_i32_max(size.y, UI_WINDOW_DIM_MIN));
+}
+
+UI_Window *ui_window_register(UI_Id id) {
+    UI_Window *window = (UI_Window *)malloc(sizeof(UI_Window));
+    memset(window, 0, sizeof(UI_Window));
+    window->id = id;
+    window->dirty = TRUE;
+    window->next = ui_state.window_first;
+    ui_state.window_first = window;
+    ui_registry_put(id, window);
+    ui_window_order_push(window);
+    return window;
+}
+
+/* Copies the commands of the window emitted this frame to its cache */
+void ui_window_cache_cmmds(UI_Window *window, UI_DrawLayer *layer) {
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    if (layer->count > window->cmmd_capacity) {
+        window->cmmd_capacity = (UI_u32)layer->count*2;
+        window->cmmds = (UI_DrawCmmd *)realloc(window->cmmds, sizeof(UI_DrawCmmd)*window->cmmd_capacity);
+        if (!window->cmmds) {
+            printf("Error: Cannot cache %u window commands\n", window->cmmd_capacity);
+            exit(-1);
+        }
+    }
+    memcpy(window->cmmds, list->cmmds + layer->first, sizeof(UI_DrawCmmd)*layer->count);
+    window->cmmd_count = (UI_u32)layer->count;
+    window->cmmds_hash = layer->hash;
+    window->cmmds_dim = window->dim;
+    window->dirty = FALSE;
+}
+
+UI_b32 ui_mouse_inside_rect(UI_V2i pos, UI_V2i dim) {
+    /* Covered by a window in front of the widget */
+    if (ui_state.window_hover && ui_state.window_hover != ui_state.window_current) {
+        return FALSE;
+    }
+    UI_b32 result = ui_state.mouse.x >= pos.x && ui_state.mouse.x < (pos.x + dim.x) &&
+        ui_state.mouse.y >= pos.y && ui_state.mouse.y < (pos.y + dim.y);
+    return result;
+}
+
+inline void ui_set_hot(UI_Id id) {
+    if (!ui_state.active) {
+        ui_state.hot = id;
+    }
+}
+
+inline void ui_set_active(UI_Id id) {
+    ui_state.active = id;
+}
+
+inline void ui_set_next_hover(UI_Id id) {
+    ui_state.next_hover = id;
+}
+
+inline UI_b32 ui_is_hot(UI_Id id) {
+    return ui_state.hot == id;
+}
+
+inline UI_b32 ui_is_active(UI_Id id) {
+    return ui_state.active == id;
+}
+
+inline UI_b32 ui_is_hover(UI_Id id) {
+    return ui_state.hover == id;
+}
+
+inline UI_b32 ui_rect_contains(UI_V2i pos, UI_V2i dim, UI_V2i point) {
+    return point.x >= pos.x && point.x < (pos.x + dim.x) && point.y >= pos.y && point.y < (pos.y + dim.y);
+}
+
+/* Front to back, the first window under the point */
+UI_Window *ui_window_at(UI_V2i point) {
+    for (UI_u32 i = ui_state.window_order_count; i > 0; --i) {
+        UI_Window *window = ui_state.window_order[i - 1];
+        if (window && ui_rect_contains(window->pos, window->dim, point)) {
+            return window;
+        }
+    }
+    return 0;
+}
+
+/* A click on a window raises it. Dragging the background moves it, dragging the grip resizes it */
+void ui_windows_update_input(void) {
+    UI_Window *window = ui_state.window_grabbed;
+    if (window) {
+        if (ui_state.mouse_is_down) {
+            UI_V2i to = v2i_sub(ui_state.mouse, ui_state.window_grab);
+            if (ui_state.window_resizing) {
+                ui_window_resize(window, to);
+            } else {
+                ui_window_move(window, to);
+            }
+        } else {
+            ui_state.window_grabbed = 0;
+            ui_set_active(0);
+        }
+    } else if (ui_state.mouse_went_down) {
+        window = ui_window_at(ui_state.mouse);
+        if (window) {
+            ui_window_raise(window);
+            /* A widget of the window that took the click keeps it */
+            if (!ui_state.active) {
+                UI_V2i grip = v2i_sub(v2i_add(window->pos, window->dim), v2i(UI_WINDOW_GRIP, UI_WINDOW_GRIP));
+                ui_state.window_resizing = ui_rect_contains(grip, v2i(UI_WINDOW_GRIP, UI_WINDOW_GRIP), ui_state.mouse);
+                ui_state.window_grab = v2i_sub(ui_state.mouse, ui_state.window_resizing ? window->dim : window->pos);
+                ui_state.window_grabbed = window;
+                ui_set_active(window->id);
+            }
+        }
+    }
+    ui_state.window_hover = ui_window_at(ui_state.mouse);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Image decoding (runs on the worker threads) */
+
+inline UI_u32 ui_read_u16_le(UI_u8 *p) {
+    return (UI_u32)p[0] | ((UI_u32)p[1] << 8);
+}
+
+inline UI_u32 ui_read_u32_le(UI_u8 *p) {
+    return (UI_u32)p[0] | ((UI_u32)p[1] << 8) | ((UI_u32)p[2] << 16) | ((UI_u32)p[3] << 24);
+}
+
+inline UI_u32 ui_read_u32_be(UI_u8 *p) {
+    return ((UI_u32)p[0] << 24) | ((UI_u32)p[1] << 16) | ((UI_u32)p[2] << 8) | (UI_u32)p[3];
+}
+
+UI_u8 *ui_decode_bmp(UI_u8 *data, UI_u64 size, UI_i32 *width, UI_i32 *height) {
+    if (size < 54 || data[0] != 'B' || data[1] != 'M') {
+        return 0;
+    }
+    UI_u32 offset = ui_read_u32_le(data + 10);
+    UI_i32 w = (UI_i32)ui_read_u32_le(data + 18);
+    UI_i32 h = (UI_i32)ui_read_u32_le(data + 22);
+    UI_u32 bpp = ui_read_u16_le(data + 28);
+    UI_u32 compression = ui_read_u32_le(data + 30);
+    /* Only uncompressed 24 and 32 bits images are supported (bitfields are assumed to be BGRA) */
+    if ((bpp != 24 && bpp != 32) || (compression != 0 && compression != 3) || w <= 0 || h == 0) {
+        return 0;
+    }
+    UI_b32 top_down = h < 0;
+    h = top_down ? -h : h;
+    UI_u64 stride = ((UI_u64)w*(bpp/8) + 3) & ~3ull;
+    if (offset + stride*(UI_u64)h > size) {
+        return 0;
+    }
+    UI_u8 *pixels = (UI_u8 *)malloc((UI_u64)w*(UI_u64)h*4);
+    for (UI_i32 y = 0; y < h; ++y) {
+        UI_u8 *src = data + offset + stride*(UI_u64)(top_down ? y : (h - 1 - y));
+        UI_u8 *dst = pixels + (UI_u64)y*(UI_u64)w*4;
+        for (UI_i32 x = 0; x < w; ++x) {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            dst[3] = (bpp == 32) ? src[3] : 255;
+            src += bpp/8;
+            dst += 4;
+        }
+    }
+    *width = w;
+    *height = h;
+    return pixels;
+}
+
+UI_u64 ui_ppm_next_token(UI_u8 *data, UI_u64 size, UI_u64 at) {
+    while (at < size) {
+        if (data[at] == '#') {
+            while (at < size && data[at] != '\n') ++at;
+        } else if (data[at] == ' ' || data[at] == '\t' || data[at] == '\r' || data[at] == '\n') {
+            ++at;
+        } else {
+            break;
+        }
+    }
+    return at;
+}
+
+UI_u64 ui_ppm_read_int(UI_u8 *data, UI_u64 size, UI_u64 at, UI_i32 *value) {
+    at = ui_ppm_next_token(data, size, at);
+    *value = 0;
+    while (at < size && data[at] >= '0' && data[at] <= '9' && *value < 65536) {
+        *value = *value*10 + (data[at++] - '0');
+    }
+    return at;
+}
+
+UI_u8 *ui_decode_ppm(UI_u8 *data, UI_u64 size, UI_i32 *width, UI_i32 *height) {
+    if (size < 2 || data[0] != 'P' || data[1] != '6') {
+        return 0;
+    }
+    UI_i32 w, h, max_value;
+    UI_u64 at = ui_ppm_read_int(data, size, 2, &w);
+    at = ui_ppm_read_int(data, size, at, &h);
+    at = ui_ppm_read_int(data, size, at, &max_value);
+    /* A single white space separates the header from the binary data */
+    at += 1;
+    if (w <= 0 || h <= 0 || max_value <= 0 || max_value > 255 || at + (UI_u64)w*(UI_u64)h*3 > size) {
+        return 0;
+    }
+    UI_u64 count = (UI_u64)w*(UI_u64)h;
+    UI_u8 *pixels = (UI_u8 *)malloc(count*4);
+    UI_u8 *src = data + at;
+    for (UI_u64 i = 0; i < count; ++i) {
+        pixels[i*4 + 0] = src[i*3 + 0];
+        pixels[i*4 + 1] = src[i*3 + 1];
+        pixels[i*4 + 2] = src[i*3 + 2];
+        pixels[i*4 + 3] = 255;
+    }
+    *width = w;
+    *height = h;
+    return pixels;
+}
+
+UI_u8 *ui_decode_qoi(UI_u8 *data, UI_u64 size, UI_i32 *width, UI_i32 *height) {
+    if (size < 22 || data[0] != 'q' || data[1] != 'o' || data[2] != 'i' || data[3] != 'f') {
+        return 0;
+    }
+    UI_u32 w = ui_read_u32_be(data + 4);
+    UI_u32 h = ui_read_u32_be(data + 8);
+    if (w == 0 || h == 0 || w > 16384 || h > 16384) {
+        return 0;
+    }
+    UI_u64 count = (UI_u64)w*(UI_u64)h;
+    UI_u8 *pixels = (UI_u8 *)malloc(count*4);
+    UI_u8 index[64][4];
+    memset(index, 0, sizeof(index));
+    UI_u8 px[4] = {0, 0, 0, 255};
+    UI_u64 at = 14;
+    UI_u64 end = size - 8; /* 8 bytes end marker */
+    UI_u32 run = 0;
+    for (UI_u64 i = 0; i < count; ++i) {
+        if (run > 0) {
+            --run;
+        } else if (at < end) {
+            UI_u8 b1 = data[at++];
+            if (b1 == 0xfe && at + 3 <= end) {
+                px[0] = data[at++]; px[1] = data[at++]; px[2] = data[at++];
+            } else if (b1 == 0xff && at + 4 <= end) {
+                px[0] = data[at++]; px[1] = data[at++]; px[2] = data[at++]; px[3] = data[at++];
+            } else if ((b1 & 0xc0) == 0x00) {
+                memcpy(px, index[b1], 4);
+            } else if ((b1 & 0xc0) == 0x40) {
+                px[0] = (UI_u8)(px[0] + ((b1 >> 4) & 3) - 2);
+                px[1] = (UI_u8)(px[1] + ((b1 >> 2) & 3) - 2);
+                px[2] = (UI_u8)(px[2] + (b1 & 3) - 2);
+            } else if ((b1 & 0xc0) == 0x80 && at < end) {
+                UI_u8 b2 = data[at++];
+                UI_i32 vg = (b1 & 0x3f) - 32;
+                px[0] = (UI_u8)(px[0] + vg - 8 + ((b2 >> 4) & 0x0f));
+                px[1] = (UI_u8)(px[1] + vg);
+                px[2] = (UI_u8)(px[2] + vg - 8 + (b2 & 0x0f));
+            } else if ((b1 & 0xc0) == 0xc0) {
+                run = b1 & 0x3f;
+            }
+            memcpy(index[(px[0]*3 + px[1]*5 + px[2]*7 + px[3]*11) % 64], px, 4);
+        }
+        memcpy(pixels + i*4, px, 4);
+    }
+    *width = (UI_i32)w;
+    *height = (UI_i32)h;
+    return pixels;
+}
+
+void ui_image_decode(UI_ImageEntry *entry) {
+    UI_u8 *pixels = 0;
+    FILE *file = fopen(entry->path, "rb");
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (size > 0) {
+            UI_u8 *data = (UI_u8 *)malloc((UI_u64)size);
+            if (fread(data, 1, (UI_u64)size, file) == (UI_u64)size) {
+                pixels = ui_decode_bmp(data, (UI_u64)size, &entry->width, &entry->height);
+                if (!pixels) pixels = ui_decode_ppm(data, (UI_u64)size, &entry->width, &entry->height);
+                if (!pixels) pixels = ui_decode_qoi(data, (UI_u64)size, &entry->width, &entry->height);
+            }
+            free(data);
+        }
+        fclose(file);
+    }
+    entry->pixels = pixels;
+    /* Publish the result, the UI thread only reads pixels after it sees UI_IMAGE_READY */
+    InterlockedExchange(&entry->state, pixels ? UI_IMAGE_READY : UI_IMAGE_FAILED);
+}
+
+DWORD WINAPI ui_image_worker_proc(LPVOID param) {
+    (void)param;
+    for (;;) {
+        WaitForSingleObject(ui_image_cache.semaphore, INFINITE);
+        if (!ui_image_cache.running) {
+            break;
+        }
+        UI_ImageEntry *entry = 0;
+        EnterCriticalSection(&ui_image_cache.lock);
+        if (ui_image_cache.queue_count > 0) {
+            entry = ui_image_cache.queue[ui_image_cache.queue_read];
+            ui_image_cache.queue_read = (ui_image_cache.queue_read + 1) % UI_IMAGE_QUEUE_MAX;
+            --ui_image_cache.queue_count;
+        }
+        LeaveCriticalSection(&ui_image_cache.lock);
+        if (entry) {
+            ui_image_decode(entry);
+        }
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Image cache (UI thread) */
+
+void ui_image_cache_init(UI_u64 budget) {
+    ui_image_cache.entries = (UI_ImageEntry *)malloc(sizeof(UI_ImageEntry)*UI_IMAGE_CACHE_MAX);
+    memset(ui_image_cache.entries, 0, sizeof(UI_ImageEntry)*UI_IMAGE_CACHE_MAX);
+    ui_image_cache.budget = budget;
+    InitializeCriticalSection(&ui_image_cache.lock);
+    ui_image_cache.semaphore = CreateSemaphoreA(0, 0, UI_IMAGE_QUEUE_MAX + UI_IMAGE_WORKER_MAX, 0);
+    ui_image_cache.running = TRUE;
+    /* Leave one core for the UI thread */
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    UI_u32 count = info.dwNumberOfProcessors > 1 ? (UI_u32)info.dwNumberOfProcessors - 1 : 1;
+    ui_image_cache.worker_count = count < UI_IMAGE_WORKER_MAX ? count : UI_IMAGE_WORKER_MAX;
+    for (UI_u32 i = 0; i < ui_image_cache.worker_count; ++i) {
+        ui_image_cache.workers[i] = CreateThread(0, 0, ui_image_worker_proc, 0, 0, 0);
+    }
+}
+
+void ui_image_lru_unlink(UI_ImageEntry *entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else ui_image_cache.lru_first = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else ui_image_cache.lru_last = entry->lru_prev;
+    entry->lru_prev = 0;
+    entry->lru_next = 0;
+}
+
+void ui_image_lru_push_front(UI_ImageEntry *entry) {
+    entry->lru_next = ui_image_cache.lru_first;
+    if (ui_image_cache.lru_first) ui_image_cache.lru_first->lru_prev = entry;
+    else ui_image_cache.lru_last = entry;
+    ui_image_cache.lru_first = entry;
+}
+
+/* The GL context belongs to the render thread, textures are retired through the draw list */
+void ui_image_evict(UI_ImageEntry *entry) {
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    ui_image_lru_unlink(entry);
+    if (entry->texture) {
+        list->retired[list->retired_count++] = entry->texture;
+        entry->texture = 0;
+    }
+    free(entry->pixels);
+    entry->pixels = 0;
+    ui_image_cache.bytes -= entry->bytes;
+    entry->bytes = 0;
+    entry->resident = FALSE;
+    entry->state = UI_IMAGE_NONE;
+    /* The slot goes back to the table, a texture still coming back for it is retired */
+    entry->key = UI_IMAGE_KEY_TOMBSTONE;
+    entry->path[0] = 0;
+}
+
+/* Evict the least recently used images until the cache fits in the budget. Images used
+   by any frame the render thread has not finished with are never evicted */
+void ui_image_cache_trim(void) {
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    UI_u64 render_frame = (UI_u64)ui_render.render_frame;
+    while (ui_image_cache.bytes > ui_image_cache.budget && ui_image_cache.lru_last &&
+           ui_image_cache.lru_last->last_used_frame < render_frame &&
+           list->retired_count < UI_RENDER_RETIRE_MAX) {
+        ui_image_evict(ui_image_cache.lru_last);
+    }
+}
+
+UI_ImageEntry *ui_image_request(char *path) {
+    UI_u64 key = ui_hash_string(path);
+    key = (key > UI_IMAGE_KEY_TOMBSTONE) ? key : UI_IMAGE_KEY_TOMBSTONE + 1;
+    UI_ImageEntry *entry = 0;
+    UI_ImageEntry *reuse = 0;
+    for (UI_u32 i = 0; i < UI_IMAGE_CACHE_MAX; ++i) {
+        UI_ImageEntry *slot = ui_image_cache.entries + ((key + i) % UI_IMAGE_CACHE_MAX);
+        if (slot->key == key) {
+            entry = slot;
+            break;
+        }
+        if (slot->key == UI_IMAGE_KEY_TOMBSTONE && !reuse) {
+            reuse = slot;
+        } else if (slot->key == UI_IMAGE_KEY_EMPTY) {
+            reuse = reuse ? reuse : slot;
+            break;
+        }
+    }
+    if (!entry) {
+        if (!reuse) {
+            return 0;
+        }
+        entry = reuse;
+        entry->key = key;
+        strncpy(entry->path, path, MAX_PATH - 1);
+        entry->path[MAX_PATH - 1] = 0;
+    }
+    if (entry->state == UI_IMAGE_NONE) {
+        /* Never block the frame: if the queue is full try again next frame */
+        EnterCriticalSection(&ui_image_cache.lock);
+        if (ui_image_cache.queue_count < UI_IMAGE_QUEUE_MAX) {
+            UI_u32 write = (ui_image_cache.queue_read + ui_image_cache.queue_count) % UI_IMAGE_QUEUE_MAX;
+            ui_image_cache.queue[write] = entry;
+            ++ui_image_cache.queue_count;
+            entry->state = UI_IMAGE_QUEUED;
+        }
+        LeaveCriticalSection(&ui_image_cache.lock);
+        if (entry->state == UI_IMAGE_QUEUED) {
+            ReleaseSemaphore(ui_image_cache.semaphore, 1, 0);
+        }
+    } else if (entry->state == UI_IMAGE_READY || entry->state == UI_IMAGE_UPLOADED) {
+        if (!entry->resident) {
+            entry->resident = TRUE;
+            entry->bytes = (UI_u64)entry->width*(UI_u64)entry->height*4;
+            ui_image_cache.bytes += entry->bytes;
+        } else {
+            ui_image_lru_unlink(entry);
+        }
+        ui_image_lru_push_front(entry);
+    }
+    /* Once the render thread is past every list built before the texture came back nothing
+       uploads from the pixels any more */
+    if (entry->state == UI_IMAGE_UPLOADED && entry->pixels &&
+        (UI_u64)ui_render.render_frame >= entry->texture_frame) {
+        free(entry->pixels);
+        entry->pixels = 0;
+    }
+    entry->last_used_frame = ui_image_cache.frame;
+    return entry;
+}
+
+void ui_image_cache_quit(void) {
+    ui_image_cache.running = FALSE;
+    ReleaseSemaphore(ui_image_cache.semaphore, (LONG)ui_image_cache.worker_count, 0);
+    for (UI_u32 i = 0; i < ui_image_cache.worker_count; ++i) {
+        WaitForSingleObject(ui_image_cache.workers[i], INFINITE);
+        CloseHandle(ui_image_cache.workers[i]);
+    }
+    CloseHandle(ui_image_cache.semaphore);
+    DeleteCriticalSection(&ui_image_cache.lock);
+    for (UI_u32 i = 0; i < UI_IMAGE_CACHE_MAX; ++i) {
+        free(ui_image_cache.entries[i].pixels);
+    }
+    free(ui_image_cache.entries);
+    ui_image_cache.entries = 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Plot series */
+
+void ui_plot_reserve(UI_Plot *plot, UI_u64 count) {
+    if (plot->count + count <= plot->capacity) {
+        return;
+    }
+    UI_u64 capacity = plot->capacity ? plot->capacity : UI_PLOT_CAPACITY_MIN;
+    while (capacity < plot->count + count) {
+        capacity *= 2;
+    }
+    plot->samples = (UI_f32 *)realloc(plot->samples, capacity*sizeof(UI_f32));
+    if (!plot->samples) {
+        printf("Error: Cannot grow plot to %llu samples\n", capacity);
+        exit(-1);
+    }
+    for (UI_u32 level = 0; level < UI_PLOT_LEVEL_MAX; ++level) {
+        UI_u32 shift = (level + 1)*UI_PLOT_LEVEL_SHIFT;
+        UI_u64 entries = (capacity + ((1ull << shift) - 1)) >> shift;
+        plot->levels[level] = (UI_PlotRange *)realloc(plot->levels[level], entries*sizeof(UI_PlotRange));
+        if (!plot->levels[level]) {
+            printf("Error: Cannot grow plot pyramid to %llu entries\n", entries);
+            exit(-1);
+        }
+    }
+    plot->capacity = capacity;
+}
+
+/* Appending only touches the last entry of every level, the pyramid is never rebuilt */
+void ui_plot_append(UI_Plot *plot, UI_f32 *values, UI_u64 count) {
+    ui_plot_reserve(plot, count);
+    for (UI_u64 i = 0; i < count; ++i) {
+        UI_u64 at = plot->count++;
+        UI_f32 value = values[i];
+        plot->samples[at] = value;
+        for (UI_u32 level = 0; level < UI_PLOT_LEVEL_MAX; ++level) {
+            UI_u32 shift = (level + 1)*UI_PLOT_LEVEL_SHIFT;
+            UI_PlotRange *range = plot->levels[level] + (at >> shift);
+            if ((at & ((1ull << shift) - 1)) == 0) {
+                range->min = value;
+                range->max = value;
+            } else {
+                range->min = value < range->min ? value : range->min;
+                range->max = value > range->max ? value : range->max;
+            }
+        }
+    }
+}
+
+/* Appends every sample published to the channel since the last frame */
+void ui_plot_drain(UI_Plot *plot, UI_Channel *channel) {
+    ASSERT(channel->element_size == sizeof(UI_f32));
+    UI_f32 samples[1024];
+    UI_u64 count;
+    while ((count = ui_channel_drain(channel, samples, sizeof(samples)/sizeof(samples[0]))) > 0) {
+        ui_plot_append(plot, samples, count);
+    }
+    ui_watch_channel(channel);
+}
+
+void ui_plot_free(UI_Plot *plot) {
+    free(plot->samples);
+    for (UI_u32 level = 0; level < UI_PLOT_LEVEL_MAX; ++level) {
+        free(plot->levels[level]);
+    }
+    memset(plot, 0, sizeof(UI_Plot));
+}
+
+/* Min and max of the samples in [first, last), every step takes the largest aligned
+   pyramid entry that fits in what is left of the range. The level climbs while the
+   start gets aligned and drops near the end, at most 7 steps per level each way */
+UI_PlotRange ui_plot_range(UI_Plot *plot, UI_u64 first, UI_u64 last) {
+    UI_PlotRange result = {FLT_MAX, -FLT_MAX};
+    UI_u64 at = first;
+    UI_u32 level = 0; /* at is always aligned to the entries of this level */
+    last = last < plot->count ? last : plot->count;
+    while (at < last) {
+        while (level < UI_PLOT_LEVEL_MAX) {
+            UI_u64 size = 1ull << ((level + 1)*UI_PLOT_LEVEL_SHIFT);
+            if ((at & (size - 1)) != 0 || at + size > last) {
+                break;
+            }
+            ++level;
+        }
+        while (level > 0 && at + (1ull << (level*UI_PLOT_LEVEL_SHIFT)) > last) {
+            --level;
+        }
+        if (level == 0) {
+            UI_f32 value = plot->samples[at++];
+            result.min = value < result.min ? value : result.min;
+            result.max = value > result.max ? value : result.max;
+        } else {
+            UI_u32 shift = level*UI_PLOT_LEVEL_SHIFT;
+            UI_PlotRange range = plot->levels[level - 1][at >> shift];
+            result.min = range.min < result.min ? range.min : result.min;
+            result.max = range.max > result.max ? range.max : result.max;
+            at += 1ull << shift;
+        }
+    }
+    return result;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Font */
+
+void ui_font_init(void) {
+    HDC device_context = CreateCompatibleDC(0);
+    HFONT font = CreateFontA(-UI_FONT_HEIGHT, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE, ANSI_CHARSET,
+                             OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, ANTIALIASED_QUALITY,
+                             FIXED_PITCH | FF_MODERN, UI_FONT_NAME);
+    HGDIOBJ old_font = SelectObject(device_context, font);
+    TEXTMETRICA metrics;
+    GetTextMetricsA(device_context, &metrics);
+    ui_font.glyph_width = metrics.tmAveCharWidth;
+    ui_font.glyph_height = metrics.tmHeight;
+    UI_i32 width = ui_font.glyph_width*16;
+    UI_i32 height = ui_font.glyph_height*16;
+
+    /* Top-down 32 bit DIB so the rows match the image pixel layout */
+    BITMAPINFO info;
+    memset(&info, 0, sizeof(BITMAPINFO));
+    info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    info.bmiHeader.biWidth = width;
+    info.bmiHeader.biHeight = -height;
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = 32;
+    info.bmiHeader.biCompression = BI_RGB;
+    void *bits = 0;
+    HBITMAP bitmap = CreateDIBSection(device_context, &info, DIB_RGB_COLORS, &bits, 0, 0);
+    HGDIOBJ old_bitmap = SelectObject(device_context, bitmap);
+    SetBkColor(device_context, RGB(0, 0, 0));
+    SetTextColor(device_context, RGB(255, 255, 255));
+    SetBkMode(device_context, OPAQUE);
+    for (UI_u32 glyph = 32; glyph < 256; ++glyph) {
+        char c = (char)glyph;
+        TextOutA(device_context, (int)(glyph % 16)*ui_font.glyph_width, (int)(glyph / 16)*ui_font.glyph_height, &c, 1);
+    }
+    GdiFlush();
+
+    /* White glyphs, the gray level rendered by GDI becomes the coverage */
+    UI_u8 *pixels = (UI_u8 *)malloc((UI_u64)width*(UI_u64)height*4);
+    UI_u8 *src = (UI_u8 *)bits;
+    for (UI_i64 i = 0; i < (UI_i64)width*height; ++i) {
+        pixels[i*4 + 0] = 255;
+        pixels[i*4 + 1] = 255;
+        pixels[i*4 + 2] = 255;
+        pixels[i*4 + 3] = src[i*4 + 1];
+    }
+    ui_font.atlas.pixels = pixels;
+    ui_font.atlas.width = width;
+    ui_font.atlas.height = height;
+    ui_font.atlas.state = UI_IMAGE_READY;
+
+    SelectObject(device_context, old_bitmap);
+    SelectObject(device_context, old_font);
+    DeleteObject(bitmap);
+    DeleteObject(font);
+    DeleteDC(device_context);
+}
+
+void ui_font_quit(void) {
+    /* The render thread may upload the atlas from any list in flight, it is kept to the end */
+    free(ui_font.atlas.pixels);
+    ui_font.atlas.pixels = 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Text buffer */
+
+inline UI_u32 ui_text_block_length(UI_TextBlock *block) {
+    return UI_TEXT_BLOCK_SIZE - (block->gap_end - block->gap_start);
+}
+
+inline UI_u8 ui_text_block_char(UI_TextBlock *block, UI_u32 at) {
+    return at < block->gap_start ? block->data[at] : block->data[at + (block->gap_end - block->gap_start)];
+}
+
+inline UI_u64 ui_text_length(UI_TextEdit *edit) {
+    return edit->block_offsets[edit->block_count];
+}
+
+/* Block that holds the character at, the last block for the end of the text */
+inline UI_u64 ui_text_block_of(UI_TextEdit *edit, UI_u64 at) {
+    UI_u64 last = edit->last_block;
+    if (last < edit->block_count && edit->block_offsets[last] <= at && at < edit->block_offsets[last + 1]) {
+        return last;
+    }
+    UI_u64 low = 0;
+    UI_u64 high = edit->block_count - 1;
+    while (low < high) {
+        UI_u64 mid = (low + high + 1) / 2;
+        if (edit->block_offsets[mid] <= at) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    edit->last_block = low;
+    return low;
+}
+
+inline UI_u8 ui_text_char(UI_TextEdit *edit, UI_u64 at) {
+    UI_u64 index = ui_text_block_of(edit, at);
+    return ui_text_block_char(edit->blocks + index, (UI_u32)(at - edit->block_offsets[index]));
+}
+
+inline UI_u64 ui_text_line_count(UI_TextEdit *edit) {
+    return edit->block_lines[edit->block_count] + 1;
+}
+
+/* Line n starts after the n-th new line, found in the first block whose lines reach it */
+UI_u64 ui_text_line_start(UI_TextEdit *edit, UI_u64 line) {
+    if (line == 0) {
+        return 0;
+    }
+    UI_u64 low = 0;
+    UI_u64 high = edit->block_count - 1;
+    while (low < high) {
+        UI_u64 mid = (low + high) / 2;
+        if (edit->block_lines[mid + 1] >= line) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return edit->block_offsets[low] + edit->blocks[low].lines[line - edit->block_lines[low] - 1];
+}
+
+/* Offset of the new line that ends the line, or the end of the text */
+inline UI_u64 ui_text_line_end(UI_TextEdit *edit, UI_u64 line) {
+    if (line + 1 < ui_text_line_count(edit)) {
+        return ui_text_line_start(edit, line + 1) - 1;
+    }
+    return ui_text_length(edit);
+}
+
+/* New lines before at, counted in the block of at */
+UI_u64 ui_text_line_of(UI_TextEdit *edit, UI_u64 at) {
+    UI_u64 index = ui_text_block_of(edit, at);
+    UI_TextBlock *block = edit->blocks + index;
+    UI_u32 local = (UI_u32)(at - edit->block_offsets[index]);
+    UI_u32 low = 0;
+    UI_u32 high = block->line_count;
+    while (low < high) {
+        UI_u32 mid = (low + high) / 2;
+        if (block->lines[mid] <= local) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return edit->block_lines[index] + low;
+}
+
+void ui_text_block_lines_reserve(UI_TextBlock *block, UI_u32 count) {
+    if (block->line_count + count <= block->line_capacity) {
+        return;
+    }
+    UI_u32 capacity = block->line_capacity ? block->line_capacity : 64;
+    while (capacity < block->line_count + count) {
+        capacity *= 2;
+    }
+    block->lines = (UI_u32 *)realloc(block->lines, capacity*sizeof(UI_u32));
+    if (!block->lines) {
+        printf("Error: Cannot grow the line index of a text block to %u lines\n", capacity);
+        exit(-1);
+    }
+    block->line_capacity = capacity;
+}
+
+/* Fills an empty block with at most UI_TEXT_BLOCK_SIZE bytes */
+void ui_text_block_fill(UI_TextBlock *block, UI_u8 *text, UI_u32 count) {
+    memcpy(block->data, text, count);
+    block->gap_start = count;
+    for (UI_u8 *at = text; (at = (UI_u8 *)memchr(at, '\n', (text + count) - at)) != 0; ++at) {
+        ui_text_block_lines_reserve(block, 1);
+        block->lines[block->line_count++] = (UI_u32)(at - text) + 1;
+    }
+}
+
+void ui_text_block_move_gap(UI_TextBlock *block, UI_u32 at) {
+    if (at < block->gap_start) {
+        UI_u32 count = block->gap_start - at;
+        memmove(block->data + block->gap_end - count, block->data + at, count);
+        block->gap_start -= count;
+        block->gap_end -= count;
+    } else if (at > block->gap_start) {
+        UI_u32 count = at - block->gap_start;
+        memmove(block->data + block->gap_start, block->data + block->gap_end, count);
+        block->gap_start += count;
+        block->gap_end += count;
+    }
+}
+
+/* First line entry after at, the lines that start after at move with an edit there */
+UI_u32 ui_text_block_line_after(UI_TextBlock *block, UI_u32 at) {
+    UI_u32 low = 0;
+    UI_u32 high = block->line_count;
+    while (low < high) {
+        UI_u32 mid = (low + high) / 2;
+        if (block->lines[mid] <= at) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/* count fits in the gap of the block */
+void ui_text_block_insert(UI_TextBlock *block, UI_u32 at, UI_u8 *text, UI_u32 count) {
+    UI_u32 new_lines = 0;
+    for (UI_u32 i = 0; i < count; ++i) {
+        if (text[i] == '\n') ++new_lines;
+    }
+    UI_u32 first = ui_text_block_line_after(block, at);
+    if (new_lines) {
+        ui_text_block_lines_reserve(block, new_lines);
+        memmove(block->lines + first + new_lines, block->lines + first, (block->line_count - first)*sizeof(UI_u32));
+        block->line_count += new_lines;
+    }
+    for (UI_u32 i = first + new_lines; i < block->line_count; ++i) {
+        block->lines[i] += count;
+    }
+    for (UI_u32 i = 0; i < count; ++i) {
+        if (text[i] == '\n') {
+            block->lines[first++] = at + i + 1;
+        }
+    }
+    ui_text_block_move_gap(block, at);
+    memcpy(block->data + block->gap_start, text, count);
+    block->gap_start += count;
+}
+
+void ui_text_block_delete(UI_TextBlock *block, UI_u32 at, UI_u32 count) {
+    /* Lines that start inside of the range lose their new line */
+    UI_u32 first = ui_text_block_line_after(block, at);
+    UI_u32 last = ui_text_block_line_after(block, at + count);
+    for (UI_u32 i = last; i < block->line_count; ++i) {
+        block->lines[first + i - last] = block->lines[i] - count;
+    }
+    block->line_count -= last - first;
+    ui_text_block_move_gap(block, at);
+    block->gap_end += count;
+}
+
+/* Prefix sums of the blocks from index on */
+void ui_text_update(UI_TextEdit *edit, UI_u64 index) {
+    for (UI_u64 i = index; i < edit->block_count; ++i) {
+        edit->block_offsets[i + 1] = edit->block_offsets[i] + ui_text_block_length(edit->blocks + i);
+        edit->block_lines[i + 1] = edit->block_lines[i] + edit->blocks[i].line_count;
+    }
+}
+
+/* Opens count empty blocks at index */
+void ui_text_blocks_insert(UI_TextEdit *edit, UI_u64 index, UI_u64 count) {
+    if (edit->block_count + count > edit->block_capacity) {
+        UI_u64 capacity = edit->block_capacity ? edit->block_capacity*2 : 64;
+        while (capacity < edit->block_count + count) {
+            capacity *= 2;
+        }
+        edit->blocks = (UI_TextBlock *)realloc(edit->blocks, capacity*sizeof(UI_TextBlock));
+        edit->block_offsets = (UI_u64 *)realloc(edit->block_offsets, (capacity + 1)*sizeof(UI_u64));
+        edit->block_lines = (UI_u64 *)realloc(edit->block_lines, (capacity + 1)*sizeof(UI_u64));
+        if (!edit->blocks || !edit->block_offsets || !edit->block_lines) {
+            printf("Error: Cannot grow text buffer to %llu blocks\n", capacity);
+            exit(-1);
+        }
+        edit->block_capacity = capacity;
+    }
+    memmove(edit->blocks + index + count, edit->blocks + index, (edit->block_count - index)*sizeof(UI_TextBlock));
+    /* The prefix sums after index are stale until ui_text_update */
+    memmove(edit->block_offsets + index + count + 1, edit->block_offsets + index + 1, (edit->block_count - index)*sizeof(UI_u64));
+    memmove(edit->block_lines + index + count + 1, edit->block_lines + index + 1, (edit->block_count - index)*sizeof(UI_u64));
+    edit->block_count += count;
+    for (UI_u64 i = index; i < index + count; ++i) {
+        UI_TextBlock *block = edit->blocks + i;
+        memset(block, 0, sizeof(UI_TextBlock));
+        block->data = (UI_u8 *)malloc(UI_TEXT_BLOCK_SIZE);
+        if (!block->data) {
+            printf("Error: Cannot allocate text block\n");
+            exit(-1);
+        }
+        block->gap_end = UI_TEXT_BLOCK_SIZE;
+    }
+}
+
+void ui_text_blocks_remove(UI_TextEdit *edit, UI_u64 index, UI_u64 count) {
+    for (UI_u64 i = index; i < index + count; ++i) {
+        free(edit->blocks[i].data);
+        free(edit->blocks[i].lines);
+    }
+    UI_u64 tail = edit->block_count - index - count;
+    memmove(edit->blocks + index, edit->blocks + index + count, tail*sizeof(UI_TextBlock));
+    memmove(edit->block_offsets + index + 1, edit->block_offsets + index + count + 1, tail*sizeof(UI_u64));
+    memmove(edit->block_lines + index + 1, edit->block_lines + index + count + 1, tail*sizeof(UI_u64));
+    edit->block_count -= count;
+}
+
+/* Moves the text of block index after at into a new block behind it */
+void ui_text_block_split(UI_TextEdit *edit, UI_u64 index, UI_u32 at) {
+    ui_text_blocks_insert(edit, index + 1, 1);
+    UI_TextBlock *block = edit->blocks + index;
+    UI_TextBlock *next = block + 1;
+    ui_text_block_move_gap(block, at);
+    UI_u32 count = UI_TEXT_BLOCK_SIZE - block->gap_end;
+    memcpy(next->data, block->data + block->gap_end, count);
+    next->gap_start = count;
+    block->gap_end = UI_TEXT_BLOCK_SIZE;
+    UI_u32 first = ui_text_block_line_after(block, at);
+    ui_text_block_lines_reserve(next, block->line_count - first);
+    for (UI_u32 i = first; i < block->line_count; ++i) {
+        next->lines[next->line_count++] = block->lines[i] - at;
+    }
+    block->line_count = first;
+}
+
+/* Joins block index with the next one when both fit in half a block, deletes leave small blocks */
+void ui_text_block_merge(UI_TextEdit *edit, UI_u64 index) {
+    if (index + 1 >= edit->block_count) {
+        return;
+    }
+    UI_TextBlock *block = edit->blocks + index;
+    UI_TextBlock *next = block + 1;
+    UI_u32 length = ui_text_block_length(block);
+    if (length + ui_text_block_length(next) > UI_TEXT_BLOCK_SIZE/2) {
+        return;
+    }
+    ui_text_block_move_gap(block, length);
+    ui_text_block_move_gap(next, ui_text_block_length(next));
+    memcpy(block->data + length, next->data, next->gap_start);
+    block->gap_start += next->gap_start;
+    ui_text_block_lines_reserve(block, next->line_count);
+    for (UI_u32 i = 0; i < next->line_count; ++i) {
+        block->lines[block->line_count++] = next->lines[i] + length;
+    }
+    ui_text_blocks_remove(edit, index + 1, 1);
+}
+
+void ui_text_init(UI_TextEdit *edit, UI_u8 *text, UI_u64 size) {
+    memset(edit, 0, sizeof(UI_TextEdit));
+    UI_u64 count = (size + UI_TEXT_BLOCK_FILL - 1) / UI_TEXT_BLOCK_FILL;
+    ui_text_blocks_insert(edit, 0, count ? count : 1);
+    edit->block_offsets[0] = 0;
+    edit->block_lines[0] = 0;
+    for (UI_u64 i = 0; i < count; ++i) {
+        UI_u64 offset = i*UI_TEXT_BLOCK_FILL;
+        UI_u64 length = size - offset < UI_TEXT_BLOCK_FILL ? size - offset : UI_TEXT_BLOCK_FILL;
+        ui_text_block_fill(edit->blocks + i, text + offset, (UI_u32)length);
+    }
+    ui_text_update(edit, 0);
+}
+
+UI_b32 ui_text_load(UI_TextEdit *edit, char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return FALSE;
+    }
+    _fseeki64(file, 0, SEEK_END);
+    UI_u64 size = (UI_u64)_ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+    UI_u8 *text = (UI_u8 *)malloc(size ? size : 1);
+    UI_b32 result = fread(text, 1, size, file) == size;
+    fclose(file);
+    if (result) {
+        ui_text_init(edit, text, size);
+    }
+    free(text);
+    return result;
+}
+
+void ui_text_free(UI_TextEdit *edit) {
+    ui_text_blocks_remove(edit, 0, edit->block_count);
+    free(edit->blocks);
+    free(edit->block_offsets);
+    free(edit->block_lines);
+    memset(edit, 0, sizeof(UI_TextEdit));
+}
+
+void ui_text_insert(UI_TextEdit *edit, UI_u64 at, UI_u8 *text, UI_u64 count) {
+    UI_u64 index = ui_text_block_of(edit, at);
+    UI_u32 local = (UI_u32)(at - edit->block_offsets[index]);
+    UI_u32 length = ui_text_block_length(edit->blocks + index);
+    if (count > UI_TEXT_BLOCK_SIZE/2) {
+        /* Large text goes into blocks of its own, the block around at is split */
+        UI_u64 first = local ? index + 1 : index;
+        if (local && local < length) {
+            ui_text_block_split(edit, index, local);
+        }
+        UI_u64 blocks = (count + UI_TEXT_BLOCK_FILL - 1) / UI_TEXT_BLOCK_FILL;
+        ui_text_blocks_insert(edit, first, blocks);
+        for (UI_u64 i = 0; i < blocks; ++i) {
+            UI_u64 offset = i*UI_TEXT_BLOCK_FILL;
+            UI_u64 size = count - offset < UI_TEXT_BLOCK_FILL ? count - offset : UI_TEXT_BLOCK_FILL;
+            ui_text_block_fill(edit->blocks + first + i, text + offset, (UI_u32)size);
+        }
+        if (length == 0) {
+            /* The only block of an empty document */
+            ui_text_blocks_remove(edit, first + blocks, 1);
+        }
+        ui_text_update(edit, index);
+        return;
+    }
+    if (count > UI_TEXT_BLOCK_SIZE - length) {
+        /* Both halves of a full block have room for half a block */
+        UI_u32 half = length/2;
+        ui_text_block_split(edit, index, half);
+        if (local > half) {
+            ui_text_block_insert(edit->blocks + index + 1, local - half, text, (UI_u32)count);
+            ui_text_update(edit, index);
+            return;
+        }
+    }
+    ui_text_block_insert(edit->blocks + index, local, text, (UI_u32)count);
+    ui_text_update(edit, index);
+}
+
+void ui_text_delete(UI_TextEdit *edit, UI_u64 at, UI_u64 count) {
+    UI_u64 length = ui_text_length(edit);
+    if (at >= length) {
+        return;
+    }
+    count = at + count > length ? length - at : count;
+    UI_u64 index = ui_text_block_of(edit, at);
+    UI_u64 first = index;
+    UI_u32 local = (UI_u32)(at - edit->block_offsets[index]);
+    if (local) {
+        UI_u32 block_length = ui_text_block_length(edit->blocks + index);
+        UI_u32 head = count < block_length - local ? (UI_u32)count : block_length - local;
+        ui_text_block_delete(edit->blocks + index, local, head);
+        count -= head;
+        ++index;
+    }
+    /* Blocks inside of the range are freed, one empty block is kept for an empty document */
+    UI_u64 end = index;
+    while (end < edit->block_count && count && count >= ui_text_block_length(edit->blocks + end)) {
+        count -= ui_text_block_length(edit->blocks + end);
+        ++end;
+    }
+    if (end - index == edit->block_count) {
+        --end;
+        ui_text_block_delete(edit->blocks + end, 0, ui_text_block_length(edit->blocks + end));
+    }
+    ui_text_blocks_remove(edit, index, end - index);
+    if (count) {
+        ui_text_block_delete(edit->blocks + index, 0, (UI_u32)count);
+    }
+    ui_text_block_merge(edit, first);
+    if (first > 0) {
+        ui_text_block_merge(edit, first - 1);
+        --first;
+    }
+    ui_text_update(edit, first);
+}
+
+/* ------------------------------------------------------------------------ */
+/* UI state snapshot */
+
+/* Relocate a stored offset, 0 and out of range offsets become null */
+inline void *ui_snapshot_ptr(UI_u64 offset, UI_u64 object_size) {
+    if (offset == 0 || offset + object_size > ui_state.snapshot_size) {
+        return 0;
+    }
+    return ui_state.snapshot + offset;
+}
+
+void ui_snapshot_unmap(void) {
+    if (ui_state.snapshot) {
+        UnmapViewOfFile(ui_state.snapshot);
+        CloseHandle(ui_state.snapshot_mapping);
+        CloseHandle(ui_state.snapshot_file);
+        ui_state.snapshot = 0;
+        ui_state.snapshot_size = 0;
+    }
+}
+
+void ui_snapshot_load(char *path) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = 0;
+    UI_u8 *base = 0;
+    if (GetFileSizeEx(file, &size) && (UI_u64)size.QuadPart >= sizeof(UI_SnapshotHeader)) {
+        mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+        if (mapping) {
+            base = (UI_u8 *)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        }
+    }
+    if (!base) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return;
+    }
+    ui_state.snapshot = base;
+    ui_state.snapshot_size = (UI_u64)size.QuadPart;
+    ui_state.snapshot_file = file;
+    ui_state.snapshot_mapping = mapping;
+
+    UI_SnapshotHeader *header = (UI_SnapshotHeader *)base;
+    UI_u64 capacity = header->registry_capacity;
+    UI_b32 valid = header->magic == UI_SNAPSHOT_MAGIC &&
+        header->window_size == sizeof(UI_Window) && header->widget_size == sizeof(UI_Widget) &&
+        header->slot_size == sizeof(UI_RegistrySlot) &&
+        capacity && (capacity & (capacity - 1)) == 0 && header->registry_count < capacity &&
+        ui_snapshot_ptr(header->windows_offset, (UI_u64)header->window_count*sizeof(UI_Window)) &&
+        ui_snapshot_ptr(header->widgets_offset, (UI_u64)header->widget_count*sizeof(UI_Widget)) &&
+        ui_snapshot_ptr(header->registry_offset, capacity*sizeof(UI_RegistrySlot));
+    if (!valid) {
+        ui_snapshot_unmap();
+        return;
+    }
+
+    /* Relocate in place, every page written becomes a private copy and the file is not modified */
+    UI_Window *windows = (UI_Window *)(base + header->windows_offset);
+    for (UI_u32 i = 0; i < header->window_count; ++i) {
+        windows[i].next = (UI_Window *)ui_snapshot_ptr((UI_u64)(uintptr_t)windows[i].next, sizeof(UI_Window));
+        windows[i].widget_first = (UI_Widget *)ui_snapshot_ptr((UI_u64)(uintptr_t)windows[i].widget_first, sizeof(UI_Widget));
+    }
+    UI_Widget *widgets = (UI_Widget *)(base + header->widgets_offset);
+    for (UI_u32 i = 0; i < header->widget_count; ++i) {
+        widgets[i].next = (UI_Widget *)ui_snapshot_ptr((UI_u64)(uintptr_t)widgets[i].next, sizeof(UI_Widget));
+    }
+    UI_RegistrySlot *registry = (UI_RegistrySlot *)(base + header->registry_offset);
+    for (UI_u64 i = 0; i < capacity; ++i) {
+        /* Empty slots stay null, their pages are not copied */
+        if (registry[i].value) {
+            registry[i].value = ui_snapshot_ptr((UI_u64)(uintptr_t)registry[i].value, sizeof(UI_Widget));
+        }
+    }
+    ui_state.window_first = (UI_Window *)ui_snapshot_ptr(header->window_first, sizeof(UI_Window));
+    ui_state.window_order_capacity = UI_WINDOW_ORDER_MIN;
+    while (ui_state.window_order_capacity < header->window_count) {
+        ui_state.window_order_capacity *= 2;
+    }
+    ui_state.window_order = (UI_Window **)malloc(sizeof(UI_Window *)*ui_state.window_order_capacity*2);
+    memset(ui_state.window_order, 0, sizeof(UI_Window *)*ui_state.window_order_capacity*2);
+    /* A window with a bad or taken z goes on top, compacting removes the slots left empty */
+    UI_u32 top = header->window_count;
+    for (UI_u32 i = 0; i < header->window_count; ++i) {
+        UI_u32 z = windows[i].z;
+        if (z >= header->window_count || ui_state.window_order[z]) {
+            z = top++;
+        }
+        ui_state.window_order[z] = windows + i;
+    }
+    ui_state.window_order_capacity *= 2;
+    ui_state.window_order_count = top;
+    ui_window_order_compact();
+    ui_state.registry = registry;
+    ui_state.registry_capacity = capacity;
+    ui_state.registry_count = header->registry_count;
+}
+
+/* Serialize the registry with every pointer replaced by its offset in the file */
+UI_u8 *ui_snapshot_build(UI_u64 *size) {
+    if (!ui_state.registry) {
+        return 0;
+    }
+    UI_SnapshotHeader header;
+    memset(&header, 0, sizeof(UI_SnapshotHeader));
+    header.magic = UI_SNAPSHOT_MAGIC;
+    /* Dense z values, the order array is rebuilt from them on load */
+    ui_window_order_compact();
+    header.window_size = sizeof(UI_Window);
+    header.widget_size = sizeof(UI_Widget);
+    header.slot_size = sizeof(UI_RegistrySlot);
+    header.registry_capacity = ui_state.registry_capacity;
+    header.registry_count = ui_state.registry_count;
+
+    /* File offset of every object, indexed by its registry slot */
+    UI_u64 *offsets = (UI_u64 *)malloc(sizeof(UI_u64)*ui_state.registry_capacity);
+    memset(offsets, 0, sizeof(UI_u64)*ui_state.registry_capacity);
+    UI_u64 at = sizeof(UI_SnapshotHeader);
+    header.windows_offset = at;
+    for (UI_Window *window = ui_state.window_first; window; window = window->next) {
+        offsets[ui_registry_slot(window->id)] = at;
+        at += sizeof(UI_Window);
+        ++header.window_count;
+    }
+    header.widgets_offset = at;
+    for (UI_Window *window = ui_state.window_first; window; window = window->next) {
+        for (UI_Widget *widget = window->widget_first; widget; widget = widget->next) {
+            offsets[ui_registry_slot(widget->id)] = at;
+            at += sizeof(UI_Widget);
+            ++header.widget_count;
+        }
+    }
+    header.registry_offset = at;
+    at += sizeof(UI_RegistrySlot)*ui_state.registry_capacity;
+    header.window_first = ui_state.window_first ? offsets[ui_registry_slot(ui_state.window_first->id)] : 0;
+
+    UI_u8 *buffer = (UI_u8 *)malloc(at);
+    memset(buffer, 0, at);
+    memcpy(buffer, &header, sizeof(UI_SnapshotHeader));
+    for (UI_Window *window = ui_state.window_first; window; window = window->next) {
+        UI_Window *dst = (UI_Window *)(buffer + offsets[ui_registry_slot(window->id)]);
+        *dst = *window;
+        dst->next = (UI_Window *)(uintptr_t)(window->next ? offsets[ui_registry_slot(window->next->id)] : 0);
+        dst->widget_first = (UI_Widget *)(uintptr_t)(window->widget_first ? offsets[ui_registry_slot(window->widget_first->id)] : 0);
+        /* The command cache is rebuilt by the first frame */
+        dst->dirty = TRUE;
+        dst->cmmds = 0;
+        dst->cmmd_count = 0;
+        dst->cmmd_capacity = 0;
+        for (UI_Widget *widget = window->widget_first; widget; widget = widget->next) {
+            UI_Widget *dst_widget = (UI_Widget *)(buffer + offsets[ui_registry_slot(widget->id)]);
+            *dst_widget = *widget;
+            dst_widget->next = (UI_Widget *)(uintptr_t)(widget->next ? offsets[ui_registry_slot(widget->next->id)] : 0);
+        }
+    }
+    UI_RegistrySlot *registry = (UI_RegistrySlot *)(buffer + header.registry_offset);
+    for (UI_u64 i = 0; i < ui_state.registry_capacity; ++i) {
+        registry[i].id = ui_state.registry[i].id;
+        registry[i].value = (void *)(uintptr_t)offsets[i];
+    }
+    free(offsets);
+    *size = at;
+    return buffer;
+}
+
+void ui_snapshot_write(char *path, UI_u8 *buffer, UI_u64 size) {
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        printf("Error: Cannot write ui snapshot %s\n", path);
+        return;
+    }
+    DWORD written = 0;
+    UI_b32 ok = size <= 0xFFFFFFFFull && WriteFile(file, buffer, (DWORD)size, &written, 0) && written == size;
+    CloseHandle(file);
+    /* A partial snapshot is not left behind, the next start builds everything */
+    if (!ok) {
+        printf("Error: Cannot write ui snapshot %s\n", path);
+        DeleteFileA(path);
+    }
+}
+
+void ui_init(void) {
+    /* TODO: initialize ui_state */
+    ui_quads_init();
+    ui_font_init();
+    ui_scheduler_init();
+    ui_jobs_init();
+    ui_image_cache_init(64*1024*1024);
+    ui_snapshot_load(UI_SNAPSHOT_PATH);
+}
+
+/* Objects loaded from the snapshot are released with the mapping */
+void ui_windows_free(void) {
+    UI_Window *window = ui_state.window_first;
+    while(window) {
+        free(window->cmmds);
+        UI_Widget *widget = window->widget_first;
+        while(widget) {
+            void *to_free = widget;
+            widget = widget->next;
+            if (!ui_snapshot_owns(to_free)) {
+                free(to_free);
+            }
+        }
+        void *to_free = window;
+        window = window->next;
+        if (!ui_snapshot_owns(to_free)) {
+            free(to_free);
+        }
+    }
+    if (!ui_snapshot_owns(ui_state.registry)) {
+        free(ui_state.registry);
+    }
+    ui_state.registry = 0;
+    ui_state.registry_capacity = 0;
+    ui_state.registry_count = 0;
+    ui_state.window_first = 0;
+    ui_state.window_hover = 0;
+    ui_state.window_grabbed = 0;
+    free(ui_state.window_order);
+    ui_state.window_order = 0;
+    ui_state.window_order_count = 0;
+    ui_state.window_order_capacity = 0;
+    ui_state.window_order_holes = 0;
+}
+
+void ui_quit(void) {
+    UI_u64 snapshot_size = 0;
+    UI_u8 *snapshot = ui_snapshot_build(&snapshot_size);
+    ui_windows_free();
+    printf("frame arena high water: %llu bytes\n", ui_state.frame_high_water);
+    ui_arena_free(ui_state.frame_arenas + 0);
+    ui_arena_free(ui_state.frame_arenas + 1);
+    printf("windows: %llu emitted, %llu copied, %.3f ms per frame in the window pass\n",
+           ui_state.window_emits, ui_state.window_copies,
+           ui_state.window_frames ? ui_state.window_time*1000.0/(UI_f64)ui_state.window_frames : 0.0);
+    /* A mapped file cannot be overwritten, unmap it before writing the new snapshot */
+    ui_snapshot_unmap();
+    if (snapshot) {
+        ui_snapshot_write(UI_SNAPSHOT_PATH, snapshot, snapshot_size);
+        free(snapshot);
+    }
+    ui_image_cache_quit();
+    ui_font_quit();
+    ui_scheduler_quit();
+    ui_scheduler_print_latency();
+    ui_jobs_print_metrics();
+}
+
+void ui_update(void) {
+    ui_windows_update_input();
+
+    /* UI update pass */
+    UI_Window *window = ui_state.window_first;
+    while (window) {
+        window->dim = v2i(0, (ui_default_window_margin.y));
+        UI_Widget *widget = window->widget_first; 
+        while (widget) {
+            switch (widget->type) {
+                case UI_WIDGET_BUTTON: {
+                    window->dim.x = ui_i32_max(window->dim.x, ui_default_button_dim.x + (ui_default_window_margin.x * 2));
+                    window->dim.y += ui_default_button_dim.y + ui_default_window_margin.y;
+                } break;
+                case UI_WIDGET_CHECKBOX: {
+                } break;
+                case UI_WIDGET_SLIDER: {
+                } break;
+                default: {
+                    INVALID_CODE_PATH();
+                } break;
+            }
+            widget = widget->next;
+        }
+        if (window->size.x) {
+            window->dim = window->size;
+        }
+        window = window->next;
+    }
+
+    /* UI render pass, windows back to front, every window goes to its own layer in window
+       coordinates. Only windows whose content changed emit their widgets, the others copy
+       their cached range, raising or moving a window only changes where its range goes */
+    UI_i64 window_begin = ui_time_now();
+    for (UI_u32 i = 0; i < ui_state.window_order_count; ++i) {
+        window = ui_state.window_order[i];
+        if (!window) {
+            continue;
+        }
+        if (!window->dirty && window->cmmds_dim.x == window->dim.x && window->cmmds_dim.y == window->dim.y) {
+            ui_render_push_layer(window->id, window->pos, window->dim, window->cmmds, window->cmmd_count, window->cmmds_hash);
+            ++ui_state.window_copies;
+            continue;
+        }
+        UI_DrawLayer *layer = ui_render_begin_layer(window->id, window->pos, window->dim);
+        ui_push_rounded_rect(v2i(0, 0), window->dim, 6.0f, ui_default_window_color);
+        UI_V2i widget_offset = v2i(0, 0);
+        UI_Widget *widget = window->widget_first;
+        while(widget) {
+            switch (widget->type) {
+                case UI_WIDGET_BUTTON: {
+                    UI_V2i pos = v2i_add(widget_offset, ui_default_window_margin);
+                    ui_push_rounded_rect(pos, ui_default_button_dim, 4.0f, ui_default_button_color);
+                    widget_offset.y += ui_default_button_dim.y + ui_default_window_margin.y;
+                } break;
+                case UI_WIDGET_CHECKBOX: {
+                } break;
+                case UI_WIDGET_SLIDER: {
+                } break;
+                default: {
+                    INVALID_CODE_PATH();
+                } break;
+            }
+            widget = widget->next;
+        }
+        UI_V2i grip = v2i_sub(window->dim, v2i(UI_WINDOW_GRIP, UI_WINDOW_GRIP));
+        ui_push_rounded_rect(v2i_add(grip, v2i(4, 4)), v2i(UI_WINDOW_GRIP - 6, UI_WINDOW_GRIP - 6), 2.0f, ui_default_button_color);
+        ui_render_end_layer(layer);
+        ui_window_cache_cmmds(window, layer);
+        ++ui_state.window_emits;
+    }
+    ui_state.window_time += ui_time_seconds(ui_time_now() - window_begin);
+    ++ui_state.window_frames;
+
+    /* ------------------------------------------------ */
+
+    /* TODO: See how to update frame information */
+    ui_state.mouse_went_down = FALSE;
+    ui_state.mouse_went_up = FALSE;
+    ui_state.mouse_wheel = 0;
+    ui_state.key_queue_count = 0;
+    /* TODO: Check if next_hover = 0 is necessary */
+    if (ui_state.hover != ui_state.next_hover) {
+        /* Hover only shows up in the next frame */
+        ui_request_redraw();
+    }
+    ui_state.hover = ui_state.next_hover;
+    ui_state.next_hover = 0;
+
+    ui_image_cache_trim();
+    ui_image_cache.uploads_this_frame = 0;
+    ++ui_image_cache.frame;
+    ui_frame_arena_flip();
+    ++ui_state.frame;
+}
+
+void ui_begin_window(UI_Id key, int x, int y) {
+    /* The window id seeds the ids of all the widgets inside of it */
+    ui_push_id(key);
+    UI_Id id = ui_state.id_stack[ui_state.id_stack_count - 1];
+    UI_Window *window = ui_window_get(id);
+    if (!window) {
+        /* Initialize window */
+        window = ui_window_register(id);
+        window->pos.x = x;
+        window->pos.y = y;
+    }
+    ui_state.window_current = window;
+    /* TODO: Implemets window logic */
+}
+void ui_end_window(void) {
+    ui_state.window_current = 0;
+    ui_pop_id();
+}
+
+UI_b32 ui_button(UI_Id key, char *name, int x, int y) {
+    UI_Id id = ui_id_resolve(key);
+
+    /* Widget dimensions:
+    If the widget is not iside the window x and y are abs coordinates.
+    Uf the widget is inside a window x and y are coordiantes relative to that window. */
+    UI_V2i pos = v2i(x, y);
+    UI_V2i dim = ui_default_button_dim;
+    UI_V4f color = v4f(0.4f, 0.4f, 0.4f, 1.0f);
+    UI_b32 result = FALSE;
     if (ui_state.window_current) {
         UI_Window *window = ui_state.window_current;
         UI_Widget *widget = ui_widget_get(window, id);
@@ -401,86 +3305,1059 @@ UI_b32 ui_button(void *id, char *name, int x, int y) {
             ui_set_hot(id);
         }
     }
-    if (ui_mouse_inside_rect(pos, dim)) {
-        ui_set_next_hover(id);
+    if (ui_mouse_inside_rect(pos, dim)) {
+        ui_set_next_hover(id);
+    }
+    /* Widget rendering */
+    if (ui_is_hot(id) && ui_mouse_inside_rect(pos, dim)) {
+        color = v4f(0.6f, 0.7f, 0.6f, 1.0f);
+    }
+    if (result) {
+        color = v4f(0.4f, 0.4f, 0.8f, 1.0f);
+    }
+
+    if(!ui_state.window_current) {
+        ui_push_rounded_rect(pos, dim, 4.0f, color);
+    }
+    return result;
+}
+
+/* Hot/active logic of one checkbox, shared by ui_checkbox and ui_checkbox_array */
+void ui_checkbox_logic(UI_Id id, UI_b32 *value, UI_V2i pos, UI_V2i dim) {
+    UI_V2i inner_pos = v2i_add(pos, v2i(4, 4));
+    UI_V2i inner_dim = v2i_sub(dim, v2i(8, 8));
+    if (ui_is_hover(id)) {
+        if (ui_is_active(id) && ui_state.mouse_went_up) {
+            if (ui_is_hot(id) && ui_mouse_inside_rect(inner_pos, inner_dim)) {
+                *value = !(*value);
+            }
+            ui_set_active(0);
+        } else if (ui_is_hot(id)) {
+            if (ui_state.mouse_went_down) {
+                ui_set_active(id);
+            }
+        }
+        if (ui_mouse_inside_rect(pos, dim)) {
+            ui_set_hot(id);
+        }
+    }
+    if (ui_mouse_inside_rect(pos, dim)) {
+        ui_set_next_hover(id);
+    }
+}
+
+void ui_checkbox(UI_Id key, UI_b32 *value, int x, int y) {
+    UI_Id id = ui_id_resolve(key);
+    /* Widget dimensions */
+    UI_V2i pos = v2i(x, y);
+    UI_V2i dim = ui_default_checkbox_dim;
+    UI_V4f color = v4f(0.4f, 0.4f, 0.4f, 1.0f);
+    UI_V2i inner_pos = v2i_add(pos, v2i(4, 4));
+    UI_V2i inner_dim = v2i_sub(dim, v2i(8, 8));
+    UI_V4f inner_color = v4f(0.7f, 0.7f, 0.7f, 1.0f);
+    ui_checkbox_logic(id, value, pos, dim);
+    /* Widget rendering */
+    if (ui_is_hot(id) && ui_mouse_inside_rect(pos, dim)) {
+        color = v4f(0.6f, 0.7f, 0.6f, 1.0f);
+    }
+    if (*value) {
+        inner_color = v4f(0.7f, 1.0f, 0.7f, 1.0f);
+    }
+    /* The ring and the inner rect do not overlap, every pixel is shaded once */
+    ui_push_border(pos, dim, 4.0f, 4.0f, color);
+    ui_push_rounded_rect(inner_pos, inner_dim, 2.0f, inner_color);
+}
+
+/* Hot/active logic of one slider, shared by ui_slider and ui_slider_array */
+void ui_slider_logic(UI_Id id, float *value, UI_V2i pos, UI_V2i dim) {
+    if (ui_is_hover(id)) {
+        if (ui_is_active(id)) {
+            if (ui_state.mouse_is_down) {
+                if (ui_is_hover(id) && ui_is_hot(id) && ui_mouse_inside_rect(pos, dim)) {
+                    *value = ((((UI_f32)(ui_state.mouse.x - pos.x) / dim.x) * 2) - 1);
+                }
+            }
+            if (ui_state.mouse_went_up) {
+                ui_set_active(0);
+            }
+        } else if (ui_is_hot(id)) {
+            if (ui_state.mouse_went_down) {
+                ui_set_active(id);
+            }
+        }
+        if (ui_mouse_inside_rect(pos, dim)) {
+            ui_set_hot(id);
+        }
+    }
+    if (ui_mouse_inside_rect(pos, dim)) {
+        ui_set_next_hover(id);
+    }
+}
+
+void ui_slider(UI_Id key, float *value, int x, int y) {
+    UI_Id id = ui_id_resolve(key);
+    /* Widget dimensions */
+    UI_V2i pos = v2i(x, y);
+    UI_V2i dim = ui_default_slider_dim;
+    UI_V4f color = v4f(0.4f, 0.4f, 0.4f, 1.0f);
+    UI_f32 inner_offset_x = (((*value + 1.0f) / 2.0f) * dim.x);
+    UI_V2i inner_dim = v2i(20, dim.y);
+    UI_V2i inner_pos = v2i(pos.x + (UI_i32)inner_offset_x - (inner_dim.x/2), pos.y);
+    UI_V4f inner_color = v4f(0.7f, 0.7f, 0.7f, 1.0f);
+    ui_slider_logic(id, value, pos, dim);
+    /* Widget rendering*/
+    if (ui_is_hot(id) && ui_mouse_inside_rect(inner_pos, inner_dim)) {
+        inner_color = v4f(0.6f, 0.7f, 0.6f, 1.0f);
+    }
+    /* The track is a thin line, only the knob covers the full slider height */
+    UI_i32 track_y = pos.y + dim.y/2;
+    ui_push_line(v2i(pos.x, track_y), v2i(pos.x + dim.x, track_y), 4.0f, color);
+    ui_push_rounded_rect(inner_pos, inner_dim, (UI_f32)(inner_dim.x/2), inner_color);
+}
+
+/* Widgets bound to a cell show its latest value. A change by the user is kept in the front
+   copy until the producer publishes again, they return TRUE so the caller can send it back */
+UI_b32 ui_checkbox_cell(UI_Id key, UI_ValueCell *cell, int x, int y) {
+    ASSERT(cell->element_size == sizeof(UI_b32));
+    UI_b32 *value = (UI_b32 *)ui_cell_latest(cell);
+    UI_b32 previous = *value;
+    ui_checkbox(key, value, x, y);
+    return *value != previous;
+}
+
+UI_b32 ui_slider_cell(UI_Id key, UI_ValueCell *cell, int x, int y) {
+    ASSERT(cell->element_size == sizeof(float));
+    float *value = (float *)ui_cell_latest(cell);
+    float previous = *value;
+    ui_slider(key, value, x, y);
+    return *value != previous;
+}
+
+/* One line of text, strings built every frame can come from ui_frame_format */
+void ui_label(char *text, int x, int y, UI_V4f color) {
+    UI_u64 length = strlen(text);
+    UI_DrawCmmd *glyphs = ui_draw_reserve(length);
+    for (UI_u64 i = 0; i < length; ++i) {
+        ui_write_glyph(glyphs + i, v2i(x + (UI_i32)i*ui_font.glyph_width, y), (UI_u8)text[i], color);
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+/* Widget arrays: element i has the id ui_id_resolve(key) + i, so any of hover, hot and active
+   maps back to its element with a subtraction. Only those elements and the one under the
+   cursor can react this frame, everything else is drawn straight from a template */
+
+inline UI_V2i ui_array_element_pos(UI_ArrayLayout *layout, UI_V2i dim, UI_u32 index) {
+    UI_u32 columns = layout->columns ? layout->columns : 1;
+    UI_u32 column = index % columns;
+    UI_u32 row = index / columns;
+    return v2i(layout->pos.x + (UI_i32)column*(dim.x + layout->spacing.x),
+               layout->pos.y + (UI_i32)row*(dim.y + layout->spacing.y));
+}
+
+/* Element under the cursor or count, a division instead of a test per element */
+UI_u32 ui_array_hit(UI_ArrayLayout *layout, UI_V2i dim, UI_u32 count) {
+    UI_u32 columns = layout->columns ? layout->columns : 1;
+    UI_V2i cell = v2i_add(dim, layout->spacing);
+    UI_V2i rel = v2i_sub(ui_state.mouse, layout->pos);
+    if (rel.x < 0 || rel.y < 0 || cell.x <= 0 || cell.y <= 0) {
+        return count;
+    }
+    UI_u32 column = (UI_u32)(rel.x / cell.x);
+    UI_u32 row = (UI_u32)(rel.y / cell.y);
+    if (column >= columns || rel.x % cell.x >= dim.x || rel.y % cell.y >= dim.y) {
+        return count;
+    }
+    UI_u64 index = (UI_u64)row*columns + column;
+    if (index >= count || !ui_mouse_inside_rect(ui_array_element_pos(layout, dim, (UI_u32)index), dim)) {
+        return count;
+    }
+    return (UI_u32)index;
+}
+
+/* Sorted elements that hover, hot, active or the cursor point at, duplicates removed */
+UI_u32 ui_array_live(UI_Id base, UI_u32 count, UI_u32 hit, UI_u32 *live) {
+    UI_u64 candidates[4];
+    candidates[0] = ui_state.hover - base;
+    candidates[1] = ui_state.hot - base;
+    candidates[2] = ui_state.active - base;
+    candidates[3] = hit;
+    UI_u32 live_count = 0;
+    for (UI_u32 i = 0; i < 4; ++i) {
+        if (candidates[i] >= count) {
+            continue;
+        }
+        UI_u32 index = (UI_u32)candidates[i];
+        UI_u32 at = live_count;
+        while (at > 0 && live[at - 1] > index) {
+            --at;
+        }
+        if (at > 0 && live[at - 1] == index) {
+            continue;
+        }
+        memmove(live + at + 1, live + at, sizeof(UI_u32)*(live_count - at));
+        live[at] = index;
+        ++live_count;
+    }
+    return live_count;
+}
+
+/* Same commands and the same logic as count calls to ui_slider */
+void ui_slider_array(UI_Id key, float *values, UI_u32 count, UI_ArrayLayout *layout) {
+    UI_Id base = ui_id_resolve(key);
+    UI_V2i dim = ui_default_slider_dim;
+    UI_V2i inner_dim = v2i(20, dim.y);
+    UI_i32 pad = (UI_i32)(4.0f*0.5f) + 2;
+    UI_u32 live[4];
+    UI_u32 live_count = ui_array_live(base, count, ui_array_hit(layout, dim, count), live);
+    /* The knob shows the value from before the logic, like ui_slider */
+    float before[4];
+    for (UI_u32 i = 0; i < live_count; ++i) {
+        before[i] = values[live[i]];
+        ui_slider_logic(base + live[i], values + live[i], ui_array_element_pos(layout, dim, live[i]), dim);
+    }
+
+    UI_DrawCmmd track;
+    memset(&track, 0, sizeof(UI_DrawCmmd));
+    track.type = UI_DRAW_CMMD_LINE;
+    track.dim = v2i(dim.x + pad*2, pad*2);
+    track.color = v4f(0.4f, 0.4f, 0.4f, 1.0f);
+    track.radius = 2.0f;
+    UI_DrawCmmd knob;
+    memset(&knob, 0, sizeof(UI_DrawCmmd));
+    knob.type = UI_DRAW_CMMD_ROUNDED_RECT;
+    knob.dim = inner_dim;
+    knob.color = v4f(0.7f, 0.7f, 0.7f, 1.0f);
+    knob.radius = (UI_f32)(inner_dim.x/2);
+    UI_DrawCmmd *cmmds = ui_draw_reserve((UI_u64)count*2);
+    UI_u32 columns = layout->columns ? layout->columns : 1;
+    UI_u32 live_at = 0;
+    for (UI_u32 row = 0, i = 0; i < count; ++row) {
+        UI_i32 y = layout->pos.y + (UI_i32)row*(dim.y + layout->spacing.y);
+        UI_i32 track_y = y + dim.y/2;
+        for (UI_u32 column = 0; column < columns && i < count; ++column, ++i) {
+            UI_i32 x = layout->pos.x + (UI_i32)column*(dim.x + layout->spacing.x);
+            float value = values[i];
+            if (live_at < live_count && live[live_at] == i) {
+                value = before[live_at++];
+            }
+            UI_DrawCmmd *cmmd = cmmds + i*2;
+            cmmd[0] = track;
+            cmmd[0].pos = v2i(x - pad, track_y - pad);
+            cmmd[0].a = v2i(x, track_y);
+            cmmd[0].b = v2i(x + dim.x, track_y);
+            cmmd[1] = knob;
+            cmmd[1].pos = v2i(x + (UI_i32)(((value + 1.0f) / 2.0f) * dim.x) - (inner_dim.x/2), y);
+        }
+    }
+    /* Only the hot element can be highlighted */
+    UI_u64 hot = ui_state.hot - base;
+    if (hot < count && ui_mouse_inside_rect(cmmds[hot*2 + 1].pos, inner_dim)) {
+        cmmds[hot*2 + 1].color = v4f(0.6f, 0.7f, 0.6f, 1.0f);
+    }
+}
+
+/* Same commands and the same logic as count calls to ui_checkbox */
+void ui_checkbox_array(UI_Id key, UI_b32 *values, UI_u32 count, UI_ArrayLayout *layout) {
+    UI_Id base = ui_id_resolve(key);
+    UI_V2i dim = ui_default_checkbox_dim;
+    UI_V2i inner_dim = v2i_sub(dim, v2i(8, 8));
+    UI_u32 live[4];
+    UI_u32 live_count = ui_array_live(base, count, ui_array_hit(layout, dim, count), live);
+    for (UI_u32 i = 0; i < live_count; ++i) {
+        ui_checkbox_logic(base + live[i], values + live[i], ui_array_element_pos(layout, dim, live[i]), dim);
+    }
+
+    UI_DrawCmmd ring;
+    memset(&ring, 0, sizeof(UI_DrawCmmd));
+    ring.type = UI_DRAW_CMMD_BORDER;
+    ring.dim = dim;
+    ring.color = v4f(0.4f, 0.4f, 0.4f, 1.0f);
+    ring.radius = 4.0f;
+    ring.thickness = 4.0f;
+    UI_DrawCmmd inner;
+    memset(&inner, 0, sizeof(UI_DrawCmmd));
+    inner.type = UI_DRAW_CMMD_ROUNDED_RECT;
+    inner.dim = inner_dim;
+    inner.radius = 2.0f;
+    UI_V4f colors[2];
+    colors[0] = v4f(0.7f, 0.7f, 0.7f, 1.0f);
+    colors[1] = v4f(0.7f, 1.0f, 0.7f, 1.0f);
+    UI_DrawCmmd *cmmds = ui_draw_reserve((UI_u64)count*2);
+    UI_u32 columns = layout->columns ? layout->columns : 1;
+    for (UI_u32 row = 0, i = 0; i < count; ++row) {
+        UI_i32 y = layout->pos.y + (UI_i32)row*(dim.y + layout->spacing.y);
+        for (UI_u32 column = 0; column < columns && i < count; ++column, ++i) {
+            UI_i32 x = layout->pos.x + (UI_i32)column*(dim.x + layout->spacing.x);
+            UI_DrawCmmd *cmmd = cmmds + i*2;
+            cmmd[0] = ring;
+            cmmd[0].pos = v2i(x, y);
+            cmmd[1] = inner;
+            cmmd[1].pos = v2i(x + 4, y + 4);
+            cmmd[1].color = colors[values[i] != 0];
+        }
+    }
+    UI_u64 hot = ui_state.hot - base;
+    if (hot < count && ui_mouse_inside_rect(cmmds[hot*2].pos, dim)) {
+        cmmds[hot*2].color = v4f(0.6f, 0.7f, 0.6f, 1.0f);
+    }
+}
+
+#if UI_WIDGET_ARRAY_BENCHMARK
+void ui_widget_array_benchmark(void) {
+    enum { count = 1000, frames = 200 };
+    static float values[count];
+    UI_ArrayLayout layout = { {10, 10}, {8, 4}, 8 };
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    UI_i64 begin = ui_time_now();
+    for (UI_u32 frame = 0; frame < frames; ++frame) {
+        list->count = 0;
+        for (UI_u32 i = 0; i < count; ++i) {
+            UI_V2i pos = ui_array_element_pos(&layout, ui_default_slider_dim, i);
+            ui_push_id(ui_id_int(i));
+            ui_slider(UI_ID("slider"), values + i, pos.x, pos.y);
+            ui_pop_id();
+        }
+    }
+    UI_i64 single = ui_time_now();
+    for (UI_u32 frame = 0; frame < frames; ++frame) {
+        list->count = 0;
+        ui_slider_array(UI_ID("sliders"), values, count, &layout);
+    }
+    UI_i64 bulk = ui_time_now();
+    list->count = 0;
+    printf("widget array benchmark: %u sliders, per widget %.3f ms, array %.3f ms\n", count,
+           ui_time_seconds(single - begin)*1000.0/frames, ui_time_seconds(bulk - single)*1000.0/frames);
+}
+#endif
+
+/* ------------------------------------------------------------------------ */
+/* Screen compiler, runs offline */
+
+typedef enum UI_ScreenToken {
+    UI_SCREEN_TOKEN_END,
+    UI_SCREEN_TOKEN_NEWLINE,
+    UI_SCREEN_TOKEN_WORD,
+    UI_SCREEN_TOKEN_STRING,
+    UI_SCREEN_TOKEN_OPEN,
+    UI_SCREEN_TOKEN_CLOSE,
+} UI_ScreenToken;
+
+typedef struct UI_ScreenCompiler {
+    char *path;
+    char *at;
+    char *end;
+    UI_u32 line;
+    UI_ScreenToken token;
+    char text[256];
+    UI_b32 peeked;
+    UI_ScreenNode *nodes;
+    UI_u32 node_count;
+    UI_u32 node_capacity;
+    UI_ScreenStyle styles[UI_SCREEN_STYLE_MAX];
+    char style_names[UI_SCREEN_STYLE_MAX][32];
+    UI_u32 style_count;
+    char *strings;
+    UI_u32 strings_size;
+    UI_u32 strings_capacity;
+} UI_ScreenCompiler;
+
+static char *ui_screen_node_names[UI_SCREEN_NODE_TYPE_COUNT] = {
+    "window", "container", "button", "checkbox", "slider", "label"
+};
+
+void ui_screen_error(UI_ScreenCompiler *compiler, char *message) {
+    printf("Error: %s:%u: %s (at '%s')\n", compiler->path, compiler->line, message, compiler->text);
+    exit(-1);
+}
+
+UI_ScreenToken ui_screen_next(UI_ScreenCompiler *compiler) {
+    if (compiler->peeked) {
+        compiler->peeked = FALSE;
+        return compiler->token;
+    }
+    char *at = compiler->at;
+    while (at < compiler->end && (*at == ' ' || *at == '\t' || *at == '\r' || *at == '#')) {
+        if (*at == '#') {
+            while (at < compiler->end && *at != '\n') {
+                ++at;
+            }
+        } else {
+            ++at;
+        }
+    }
+    UI_u32 length = 0;
+    UI_ScreenToken token = UI_SCREEN_TOKEN_END;
+    if (at >= compiler->end) {
+        token = UI_SCREEN_TOKEN_END;
+    } else if (*at == '\n') {
+        ++compiler->line;
+        ++at;
+        token = UI_SCREEN_TOKEN_NEWLINE;
+    } else if (*at == '{' || *at == '}') {
+        token = (*at == '{') ? UI_SCREEN_TOKEN_OPEN : UI_SCREEN_TOKEN_CLOSE;
+        compiler->text[length++] = *at++;
+    } else if (*at == '"') {
+        ++at;
+        while (at < compiler->end && *at != '"' && *at != '\n' && length < sizeof(compiler->text) - 1) {
+            compiler->text[length++] = *at++;
+        }
+        if (at >= compiler->end || *at != '"') {
+            ui_screen_error(compiler, "unterminated string");
+        }
+        ++at;
+        token = UI_SCREEN_TOKEN_STRING;
+    } else {
+        while (at < compiler->end && !strchr(" \t\r\n{}\"#", *at) && length < sizeof(compiler->text) - 1) {
+            compiler->text[length++] = *at++;
+        }
+        token = UI_SCREEN_TOKEN_WORD;
+    }
+    compiler->text[length] = 0;
+    compiler->at = at;
+    compiler->token = token;
+    return token;
+}
+
+inline UI_ScreenToken ui_screen_peek(UI_ScreenCompiler *compiler) {
+    UI_ScreenToken token = ui_screen_next(compiler);
+    compiler->peeked = TRUE;
+    return token;
+}
+
+UI_b32 ui_screen_word_is_number(char *text) {
+    char *end = 0;
+    strtod(text, &end);
+    return end != text && *end == 0;
+}
+
+UI_f32 ui_screen_number(UI_ScreenCompiler *compiler) {
+    if (ui_screen_next(compiler) != UI_SCREEN_TOKEN_WORD || !ui_screen_word_is_number(compiler->text)) {
+        ui_screen_error(compiler, "expected a number");
+    }
+    return (UI_f32)strtod(compiler->text, 0);
+}
+
+UI_u32 ui_screen_string(UI_ScreenCompiler *compiler, char *text) {
+    UI_u32 length = (UI_u32)strlen(text) + 1;
+    if (compiler->strings_size + length > compiler->strings_capacity) {
+        compiler->strings_capacity = (compiler->strings_capacity + length)*2;
+        compiler->strings = (char *)realloc(compiler->strings, compiler->strings_capacity);
+        if (!compiler->strings) {
+            printf("Error: Cannot grow the screen string table to %u bytes\n", compiler->strings_capacity);
+            exit(-1);
+        }
+    }
+    UI_u32 offset = compiler->strings_size;
+    memcpy(compiler->strings + offset, text, length);
+    compiler->strings_size += length;
+    return offset;
+}
+
+/* style NAME [color r g b a] [text r g b a] [radius n] [padding n] [spacing n] */
+void ui_screen_compile_style(UI_ScreenCompiler *compiler) {
+    if (ui_screen_next(compiler) != UI_SCREEN_TOKEN_WORD) {
+        ui_screen_error(compiler, "expected a style name");
+    }
+    if (compiler->style_count == UI_SCREEN_STYLE_MAX || strlen(compiler->text) >= 32) {
+        ui_screen_error(compiler, "too many styles or style name too long");
+    }
+    UI_u32 index = compiler->style_count++;
+    strcpy(compiler->style_names[index], compiler->text);
+    UI_ScreenStyle *style = compiler->styles + index;
+    *style = compiler->styles[0];
+    while (ui_screen_next(compiler) == UI_SCREEN_TOKEN_WORD) {
+        if (strcmp(compiler->text, "color") == 0 || strcmp(compiler->text, "text") == 0) {
+            UI_V4f *color = (compiler->text[0] == 'c') ? &style->color : &style->text_color;
+            color->x = ui_screen_number(compiler);
+            color->y = ui_screen_number(compiler);
+            color->z = ui_screen_number(compiler);
+            color->w = ui_screen_number(compiler);
+        } else if (strcmp(compiler->text, "radius") == 0) {
+            style->radius = ui_screen_number(compiler);
+        } else if (strcmp(compiler->text, "padding") == 0) {
+            style->padding = (UI_i32)ui_screen_number(compiler);
+        } else if (strcmp(compiler->text, "spacing") == 0) {
+            style->spacing = (UI_i32)ui_screen_number(compiler);
+        } else {
+            ui_screen_error(compiler, "unknown style property");
+        }
+    }
+    if (compiler->token != UI_SCREEN_TOKEN_NEWLINE && compiler->token != UI_SCREEN_TOKEN_END) {
+        ui_screen_error(compiler, "expected the end of the line");
+    }
+}
+
+void ui_screen_compile_block(UI_ScreenCompiler *compiler, UI_i32 parent, UI_u32 depth);
+
+/* TYPE "name" [x y] [column|row] [STYLE] ["text"] [{ children }] */
+void ui_screen_compile_node(UI_ScreenCompiler *compiler, UI_u32 type, UI_i32 parent, UI_u32 depth) {
+    UI_u32 parent_type = (parent >= 0) ? compiler->nodes[parent].type : UI_SCREEN_NODE_TYPE_COUNT;
+    if (type == UI_SCREEN_WINDOW && parent >= 0) {
+        ui_screen_error(compiler, "windows are top level only");
+    }
+    if (parent_type == UI_SCREEN_WINDOW && type != UI_SCREEN_BUTTON) {
+        ui_screen_error(compiler, "windows only hold buttons");
+    }
+    if (depth >= UI_SCREEN_DEPTH_MAX) {
+        ui_screen_error(compiler, "nested too deep");
+    }
+    if (ui_screen_next(compiler) != UI_SCREEN_TOKEN_STRING) {
+        ui_screen_error(compiler, "expected a quoted name");
+    }
+    if (compiler->node_count == compiler->node_capacity) {
+        compiler->node_capacity = compiler->node_capacity ? compiler->node_capacity*2 : 256;
+        compiler->nodes = (UI_ScreenNode *)realloc(compiler->nodes, sizeof(UI_ScreenNode)*compiler->node_capacity);
+        if (!compiler->nodes) {
+            printf("Error: Cannot grow the screen to %u nodes\n", compiler->node_capacity);
+            exit(-1);
+        }
+    }
+    UI_u32 index = compiler->node_count++;
+    UI_ScreenNode *node = compiler->nodes + index;
+    memset(node, 0, sizeof(UI_ScreenNode));
+    node->id = ui_hash_string(compiler->text);
+    node->type = (UI_u16)type;
+    UI_b32 has_pos = FALSE;
+    UI_b32 has_children = FALSE;
+    for (;;) {
+        UI_ScreenToken token = ui_screen_next(compiler);
+        if (token == UI_SCREEN_TOKEN_NEWLINE || token == UI_SCREEN_TOKEN_END) {
+            break;
+        } else if (token == UI_SCREEN_TOKEN_OPEN) {
+            if (type != UI_SCREEN_WINDOW && type != UI_SCREEN_CONTAINER) {
+                ui_screen_error(compiler, "only windows and containers have children");
+            }
+            has_children = TRUE;
+            break;
+        } else if (token == UI_SCREEN_TOKEN_STRING) {
+            node = compiler->nodes + index;
+            node->text = ui_screen_string(compiler, compiler->text);
+        } else if (ui_screen_word_is_number(compiler->text)) {
+            node = compiler->nodes + index;
+            node->pos.x = (UI_i32)strtod(compiler->text, 0);
+            node->pos.y = (UI_i32)ui_screen_number(compiler);
+            has_pos = TRUE;
+        } else if (strcmp(compiler->text, "column") == 0 || strcmp(compiler->text, "row") == 0) {
+            compiler->nodes[index].layout = (compiler->text[0] == 'c') ? UI_SCREEN_COLUMN : UI_SCREEN_ROW;
+        } else {
+            UI_u32 style = 0;
+            while (style < compiler->style_count && strcmp(compiler->style_names[style], compiler->text) != 0) {
+                ++style;
+            }
+            if (style == compiler->style_count) {
+                ui_screen_error(compiler, "unknown style");
+            }
+            compiler->nodes[index].style = (UI_u16)style;
+        }
+    }
+    if (has_pos != (parent < 0 || parent_type == UI_SCREEN_WINDOW)) {
+        ui_screen_error(compiler, has_pos ? "children are placed by their container" : "top level nodes need x y");
+    }
+    if (has_children) {
+        ui_screen_compile_block(compiler, (UI_i32)index, depth + 1);
+    }
+    compiler->nodes[index].size = compiler->node_count - index;
+}
+
+void ui_screen_compile_block(UI_ScreenCompiler *compiler, UI_i32 parent, UI_u32 depth) {
+    for (;;) {
+        UI_ScreenToken token = ui_screen_next(compiler);
+        if (token == UI_SCREEN_TOKEN_NEWLINE) {
+            continue;
+        }
+        if (token == UI_SCREEN_TOKEN_END || token == UI_SCREEN_TOKEN_CLOSE) {
+            if ((token == UI_SCREEN_TOKEN_CLOSE) != (parent >= 0)) {
+                ui_screen_error(compiler, (parent >= 0) ? "missing }" : "unexpected }");
+            }
+            return;
+        }
+        if (token != UI_SCREEN_TOKEN_WORD) {
+            ui_screen_error(compiler, "expected a node type or style");
+        }
+        if (strcmp(compiler->text, "style") == 0) {
+            if (parent >= 0) {
+                ui_screen_error(compiler, "styles are top level only");
+            }
+            ui_screen_compile_style(compiler);
+            continue;
+        }
+        UI_u32 type = 0;
+        while (type < UI_SCREEN_NODE_TYPE_COUNT && strcmp(ui_screen_node_names[type], compiler->text) != 0) {
+            ++type;
+        }
+        if (type == UI_SCREEN_NODE_TYPE_COUNT) {
+            ui_screen_error(compiler, "unknown node type");
+        }
+        ui_screen_compile_node(compiler, type, parent, depth);
+    }
+}
+
+/* Source to blob, prints the error and exits on a bad source */
+UI_b32 ui_screen_compile(char *source_path, char *blob_path) {
+    FILE *file = fopen(source_path, "rb");
+    if (!file) {
+        printf("Error: Cannot open screen source %s\n", source_path);
+        return FALSE;
+    }
+    _fseeki64(file, 0, SEEK_END);
+    UI_u64 size = (UI_u64)_ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+    char *source = (char *)malloc(size ? size : 1);
+    UI_b32 read = fread(source, 1, size, file) == size;
+    fclose(file);
+    if (!read) {
+        printf("Error: Cannot read screen source %s\n", source_path);
+        free(source);
+        return FALSE;
+    }
+
+    UI_ScreenCompiler compiler;
+    memset(&compiler, 0, sizeof(UI_ScreenCompiler));
+    compiler.path = source_path;
+    compiler.at = source;
+    compiler.end = source + size;
+    compiler.line = 1;
+    UI_ScreenStyle *base = compiler.styles;
+    base->color = v4f(0.2f, 0.2f, 0.24f, 1.0f);
+    base->text_color = v4f(0.9f, 0.9f, 0.9f, 1.0f);
+    base->radius = 4.0f;
+    base->padding = 8;
+    base->spacing = 6;
+    strcpy(compiler.style_names[0], "default");
+    compiler.style_count = 1;
+    ui_screen_string(&compiler, "");
+    ui_screen_compile_block(&compiler, -1, 0);
+    free(source);
+
+    UI_ScreenHeader header;
+    memset(&header, 0, sizeof(UI_ScreenHeader));
+    header.magic = UI_SCREEN_MAGIC;
+    header.node_size = sizeof(UI_ScreenNode);
+    header.style_size = sizeof(UI_ScreenStyle);
+    header.node_count = compiler.node_count;
+    header.style_count = compiler.style_count;
+    header.nodes_offset = sizeof(UI_ScreenHeader);
+    header.styles_offset = header.nodes_offset + sizeof(UI_ScreenNode)*compiler.node_count;
+    header.strings_offset = header.styles_offset + sizeof(UI_ScreenStyle)*compiler.style_count;
+    header.strings_size = compiler.strings_size;
+    FILE *out = fopen(blob_path, "wb");
+    UI_b32 written = out != 0;
+    if (out) {
+        written &= fwrite(&header, sizeof(UI_ScreenHeader), 1, out) == 1;
+        written &= fwrite(compiler.nodes, sizeof(UI_ScreenNode), compiler.node_count, out) == compiler.node_count;
+        written &= fwrite(compiler.styles, sizeof(UI_ScreenStyle), compiler.style_count, out) == compiler.style_count;
+        written &= fwrite(compiler.strings, 1, compiler.strings_size, out) == compiler.strings_size;
+        fclose(out);
+    }
+    if (!written) {
+        printf("Error: Cannot write screen blob %s\n", blob_path);
+    }
+    free(compiler.nodes);
+    free(compiler.strings);
+    return written;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Screen runtime */
+
+/* Sizes bottom up (children follow their parent in the blob) then positions top down */
+void ui_screen_layout(UI_Screen *screen) {
+    for (UI_u32 i = screen->node_count; i > 0; --i) {
+        UI_ScreenNode *node = screen->nodes + (i - 1);
+        UI_ScreenValue *value = screen->values + (i - 1);
+        switch (node->type) {
+            case UI_SCREEN_BUTTON: { value->dim = ui_default_button_dim; } break;
+            case UI_SCREEN_CHECKBOX: { value->dim = ui_default_checkbox_dim; } break;
+            case UI_SCREEN_SLIDER: { value->dim = ui_default_slider_dim; } break;
+            case UI_SCREEN_LABEL: {
+                value->dim = v2i((UI_i32)strlen(screen->strings + node->text)*ui_font.glyph_width, ui_font.glyph_height);
+            } break;
+            case UI_SCREEN_CONTAINER: {
+                UI_ScreenStyle *style = screen->styles + node->style;
+                UI_V2i dim = v2i(0, 0);
+                for (UI_u32 child = i; child < i - 1 + node->size; child += screen->nodes[child].size) {
+                    UI_V2i child_dim = screen->values[child].dim;
+                    if (node->layout == UI_SCREEN_COLUMN) {
+                        dim.x = ui_i32_max(dim.x, child_dim.x);
+                        dim.y += child_dim.y + (dim.y ? style->spacing : 0);
+                    } else {
+                        dim.x += child_dim.x + (dim.x ? style->spacing : 0);
+                        dim.y = ui_i32_max(dim.y, child_dim.y);
+                    }
+                }
+                value->dim = v2i(dim.x + style->padding*2, dim.y + style->padding*2);
+            } break;
+            default: { } break;
+        }
+    }
+    for (UI_u32 i = 0; i < screen->node_count;) {
+        screen->values[i].pos = screen->nodes[i].pos;
+        i += screen->nodes[i].size;
+    }
+    for (UI_u32 i = 0; i < screen->node_count; ++i) {
+        UI_ScreenNode *node = screen->nodes + i;
+        if (node->type != UI_SCREEN_CONTAINER) {
+            continue;
+        }
+        UI_ScreenStyle *style = screen->styles + node->style;
+        UI_V2i at = v2i_add(screen->values[i].pos, v2i(style->padding, style->padding));
+        for (UI_u32 child = i + 1; child < i + node->size; child += screen->nodes[child].size) {
+            screen->values[child].pos = at;
+            if (node->layout == UI_SCREEN_COLUMN) {
+                at.y += screen->values[child].dim.y + style->spacing;
+            } else {
+                at.x += screen->values[child].dim.x + style->spacing;
+            }
+        }
+    }
+}
+
+void ui_screen_unload(UI_Screen *screen) {
+    if (screen->base) {
+        UnmapViewOfFile(screen->base);
+        CloseHandle(screen->mapping);
+        CloseHandle(screen->file);
+    }
+    free(screen->values);
+    memset(screen, 0, sizeof(UI_Screen));
+}
+
+/* Array of count elements at offset fits in a blob of size bytes and is aligned for its
+   elements, written so that no sum or product can wrap around */
+inline UI_b32 ui_screen_span_valid(UI_u64 size, UI_u64 offset, UI_u64 count, UI_u64 elem, UI_u64 align) {
+    return offset <= size && count <= (size - offset)/elem && (offset & (align - 1)) == 0;
+}
+
+/* Maps the blob read only, checks that every offset stays inside of it and lays it out */
+UI_b32 ui_screen_load(UI_Screen *screen, char *path) {
+    memset(screen, 0, sizeof(UI_Screen));
+    screen->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (screen->file == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(screen->file, &size) && (UI_u64)size.QuadPart >= sizeof(UI_ScreenHeader)) {
+        screen->mapping = CreateFileMappingA(screen->file, 0, PAGE_READONLY, 0, 0, 0);
+        if (screen->mapping) {
+            screen->base = (UI_u8 *)MapViewOfFile(screen->mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+    }
+    if (!screen->base) {
+        if (screen->mapping) CloseHandle(screen->mapping);
+        CloseHandle(screen->file);
+        memset(screen, 0, sizeof(UI_Screen));
+        return FALSE;
+    }
+    screen->size = (UI_u64)size.QuadPart;
+    UI_ScreenHeader *header = (UI_ScreenHeader *)screen->base;
+    UI_b32 valid = header->magic == UI_SCREEN_MAGIC &&
+        header->node_size == sizeof(UI_ScreenNode) && header->style_size == sizeof(UI_ScreenStyle) &&
+        header->style_count > 0 && header->strings_size > 0 &&
+        ui_screen_span_valid(screen->size, header->nodes_offset, header->node_count, sizeof(UI_ScreenNode), sizeof(UI_u64)) &&
+        ui_screen_span_valid(screen->size, header->styles_offset, header->style_count, sizeof(UI_ScreenStyle), sizeof(UI_f32)) &&
+        ui_screen_span_valid(screen->size, header->strings_offset, header->strings_size, 1, 1) &&
+        screen->base[header->strings_offset + header->strings_size - 1] == 0;
+    if (valid) {
+        screen->nodes = (UI_ScreenNode *)(screen->base + header->nodes_offset);
+        screen->styles = (UI_ScreenStyle *)(screen->base + header->styles_offset);
+        screen->strings = (char *)(screen->base + header->strings_offset);
+        screen->node_count = header->node_count;
+        screen->style_count = header->style_count;
+        for (UI_u32 i = 0; i < screen->node_count && valid; ++i) {
+            UI_ScreenNode *node = screen->nodes + i;
+            valid = node->type < UI_SCREEN_NODE_TYPE_COUNT && node->style < screen->style_count &&
+                node->text < header->strings_size && node->size > 0 && node->size <= screen->node_count - i;
+        }
+    }
+    if (!valid) {
+        printf("Error: Bad screen blob %s\n", path);
+        ui_screen_unload(screen);
+        return FALSE;
     }
-    /* Widget rendering */
-    if (ui_is_hot(id) && ui_mouse_inside_rect(pos, dim)) {
-        color = v4f(0.6f, 0.7f, 0.6f, 1.0f);
+    screen->values = (UI_ScreenValue *)malloc(sizeof(UI_ScreenValue)*(screen->node_count ? screen->node_count : 1));
+    if (!screen->values) {
+        printf("Error: Cannot allocate state for %u screen nodes\n", screen->node_count);
+        exit(-1);
     }
-    if (result) {
-        color = v4f(0.4f, 0.4f, 0.8f, 1.0f);
+    memset(screen->values, 0, sizeof(UI_ScreenValue)*screen->node_count);
+    ui_screen_layout(screen);
+    return TRUE;
+}
+
+/* Runs the widgets of the screen for this frame, containers scope the ids of their children */
+void ui_screen_frame(UI_Screen *screen) {
+    UI_u32 ends[UI_SCREEN_DEPTH_MAX];
+    UI_u32 depth = 0;
+    for (UI_u32 i = 0; i < screen->node_count;) {
+        while (depth && ends[depth - 1] == i) {
+            ui_pop_id();
+            --depth;
+        }
+        UI_ScreenNode *node = screen->nodes + i;
+        UI_ScreenValue *value = screen->values + i;
+        UI_ScreenStyle *style = screen->styles + node->style;
+        char *text = screen->strings + node->text;
+        switch (node->type) {
+            case UI_SCREEN_WINDOW: {
+                ui_begin_window(node->id, value->pos.x, value->pos.y);
+                for (UI_u32 child = i + 1; child < i + node->size; ++child) {
+                    screen->values[child].pressed = ui_button(screen->nodes[child].id, screen->strings + screen->nodes[child].text, 0, 0);
+                }
+                ui_end_window();
+                i += node->size;
+                continue;
+            }
+            case UI_SCREEN_CONTAINER: {
+                ui_push_rounded_rect(value->pos, value->dim, style->radius, style->color);
+                if (node->size > 1 && depth < UI_SCREEN_DEPTH_MAX) {
+                    ui_push_id(node->id);
+                    ends[depth++] = i + node->size;
+                }
+            } break;
+            case UI_SCREEN_BUTTON: {
+                value->pressed = ui_button(node->id, text, value->pos.x, value->pos.y);
+            } break;
+            case UI_SCREEN_CHECKBOX: {
+                ui_checkbox(node->id, &value->checked, value->pos.x, value->pos.y);
+            } break;
+            case UI_SCREEN_SLIDER: {
+                ui_slider(node->id, &value->value, value->pos.x, value->pos.y);
+            } break;
+            case UI_SCREEN_LABEL: {
+                ui_label(text, value->pos.x, value->pos.y, style->text_color);
+            } break;
+        }
+        ++i;
+    }
+    while (depth--) {
+        ui_pop_id();
     }
+}
 
-    if(!ui_state.window_current) {
-        ui_push_rect(pos, dim, color);
+/* State of the node with the given name, the first match in the blob */
+UI_ScreenValue *ui_screen_value(UI_Screen *screen, UI_Id key) {
+    for (UI_u32 i = 0; i < screen->node_count; ++i) {
+        if (screen->nodes[i].id == key) {
+            return screen->values + i;
+        }
     }
-    return result;
+    return 0;
+}
+
+void ui_image(char *path, int x, int y, int w, int h) {
+    UI_V2i pos = v2i(x, y);
+    UI_V2i dim = v2i(w, h);
+    UI_ImageEntry *image = ui_image_request(path);
+    /* Only a few textures are created per frame so a burst of decoded images never stalls the UI */
+    UI_b32 can_draw = FALSE;
+    if (image && image->state == UI_IMAGE_UPLOADED) {
+        can_draw = TRUE;
+    } else if (image && image->state == UI_IMAGE_READY &&
+               ui_image_cache.uploads_this_frame < UI_IMAGE_UPLOADS_PER_FRAME) {
+        ++ui_image_cache.uploads_this_frame;
+        can_draw = TRUE;
+    }
+    if (can_draw) {
+        UI_DrawCmmd *cmmd = ui_draw_reserve(1);
+        memset(cmmd, 0, sizeof(UI_DrawCmmd));
+        cmmd->type = UI_DRAW_CMMD_IMAGE;
+        cmmd->pos = pos;
+        cmmd->dim = dim;
+        cmmd->color = v4f(1.0f, 1.0f, 1.0f, 1.0f);
+        cmmd->image = image;
+        cmmd->texture = image->texture;
+    } else {
+        /* Placeholder while the image is decoding, keep building frames until it shows up */
+        if (!image || image->state != UI_IMAGE_FAILED) {
+            ui_request_redraw();
+        }
+        UI_V4f color = (image && image->state == UI_IMAGE_FAILED) ? v4f(0.6f, 0.3f, 0.3f, 1.0f) : v4f(0.3f, 0.3f, 0.3f, 1.0f);
+        ui_push_rounded_rect(pos, dim, 4.0f, color);
+    }
+}
+
+/* Places the cursor on the column of a line, clamped to the end of the line */
+UI_u64 ui_text_edit_offset(UI_TextEdit *edit, UI_u64 line, UI_u64 column) {
+    UI_u64 start = ui_text_line_start(edit, line);
+    UI_u64 end = ui_text_line_end(edit, line);
+    return (start + column < end) ? start + column : end;
 }
 
-void ui_checkbox(void *id, UI_b32 *value, int x, int y) {
+/* Only the visible lines are read and drawn, the cost of a frame does not depend on the size of the document */
+void ui_text_edit(UI_Id key, UI_TextEdit *edit, int x, int y, int w, int h) {
+    UI_Id id = ui_id_resolve(key);
     /* Widget dimensions */
     UI_V2i pos = v2i(x, y);
-    UI_V2i dim = ui_default_checkbox_dim;
-    UI_V4f color = v4f(0.4f, 0.4f, 0.4f, 1.0f);
-    UI_V2i inner_pos = v2i_add(pos, v2i(4, 4));
-    UI_V2i inner_dim = v2i_sub(dim, v2i(8, 8));
-    UI_V4f inner_color = v4f(0.7f, 0.7f, 0.7f, 1.0f);
+    UI_V2i dim = v2i(w, h);
+    UI_V2i text_pos = v2i(x + UI_TEXT_EDIT_PADDING, y + UI_TEXT_EDIT_PADDING);
+    UI_i32 rows = (h - UI_TEXT_EDIT_PADDING*2) / ui_font.glyph_height;
+    UI_i32 columns = (w - UI_TEXT_EDIT_PADDING*2) / ui_font.glyph_width;
+    UI_V4f color = v4f(0.15f, 0.15f, 0.15f, 1.0f);
+    UI_V4f text_color = v4f(0.85f, 0.85f, 0.85f, 1.0f);
+    UI_V4f cursor_color = v4f(0.6f, 0.7f, 0.6f, 1.0f);
+    UI_u64 line_count = ui_text_line_count(edit);
     /* Widget logic */
-    if (ui_is_hover(id)) {
-        if (ui_is_active(id) && ui_state.mouse_went_up) {
-            if (ui_is_hot(id) && ui_mouse_inside_rect(inner_pos, inner_dim)) {
-                *value = !(*value);
-            }
-            ui_set_active(0);
-        } else if (ui_is_hot(id)) {
-            if (ui_state.mouse_went_down) {
-                ui_set_active(id);
-            }
-        }
+    if (ui_state.mouse_went_down) {
         if (ui_mouse_inside_rect(pos, dim)) {
-            ui_set_hot(id);
+            ui_state.focus = id;
+            UI_i64 line = (UI_i64)edit->scroll_line + (ui_state.mouse.y - text_pos.y) / ui_font.glyph_height;
+            UI_i64 column = (UI_i64)edit->scroll_column + (ui_state.mouse.x - text_pos.x + ui_font.glyph_width/2) / ui_font.glyph_width;
+            line = line < 0 ? 0 : (line >= (UI_i64)line_count ? (UI_i64)line_count - 1 : line);
+            edit->cursor = ui_text_edit_offset(edit, (UI_u64)line, column < 0 ? 0 : (UI_u64)column);
+        } else if (ui_state.focus == id) {
+            ui_state.focus = 0;
         }
     }
     if (ui_mouse_inside_rect(pos, dim)) {
         ui_set_next_hover(id);
     }
+    UI_b32 cursor_moved = FALSE;
+    if (ui_state.focus == id) {
+        for (UI_u32 i = 0; i < ui_state.key_queue_count; ++i) {
+            UI_KeyEvent *event = ui_state.key_queue + i;
+            UI_u64 line = ui_text_line_of(edit, edit->cursor);
+            UI_u64 column = edit->cursor - ui_text_line_start(edit, line);
+            cursor_moved = TRUE;
+            if (event->type == UI_KEY_EVENT_CHAR) {
+                /* Backspace and the other control characters arrive as WM_KEYDOWN as well */
+                UI_u8 c = (UI_u8)((event->code == '\r') ? '\n' : (event->code < 256 ? event->code : '?'));
+                if (c >= 32 || c == '\n' || c == '\t') {
+                    ui_text_insert(edit, edit->cursor, &c, 1);
+                    ++edit->cursor;
+                }
+                continue;
+            }
+            switch (event->code) {
+                case VK_LEFT: {
+                    if (edit->cursor > 0) --edit->cursor;
+                } break;
+                case VK_RIGHT: {
+                    if (edit->cursor < ui_text_length(edit)) ++edit->cursor;
+                } break;
+                case VK_UP: {
+                    if (line > 0) edit->cursor = ui_text_edit_offset(edit, line - 1, column);
+                } break;
+                case VK_DOWN: {
+                    if (line + 1 < ui_text_line_count(edit)) edit->cursor = ui_text_edit_offset(edit, line + 1, column);
+                } break;
+                case VK_PRIOR: {
+                    line = line > (UI_u64)rows ? line - (UI_u64)rows : 0;
+                    edit->cursor = ui_text_edit_offset(edit, line, column);
+                } break;
+                case VK_NEXT: {
+                    line = line + (UI_u64)rows < ui_text_line_count(edit) ? line + (UI_u64)rows : ui_text_line_count(edit) - 1;
+                    edit->cursor = ui_text_edit_offset(edit, line, column);
+                } break;
+                case VK_HOME: {
+                    edit->cursor = ui_text_line_start(edit, line);
+                } break;
+                case VK_END: {
+                    edit->cursor = ui_text_line_end(edit, line);
+                } break;
+                case VK_BACK: {
+                    if (edit->cursor > 0) {
+                        --edit->cursor;
+                        ui_text_delete(edit, edit->cursor, 1);
+                    }
+                } break;
+                case VK_DELETE: {
+                    ui_text_delete(edit, edit->cursor, 1);
+                } break;
+                default: {
+                } break;
+            }
+        }
+        line_count = ui_text_line_count(edit);
+    }
+    if (ui_is_hover(id) && ui_state.mouse_wheel) {
+        UI_i64 scroll = (UI_i64)edit->scroll_line - (ui_state.mouse_wheel / WHEEL_DELTA)*3;
+        UI_i64 last = (UI_i64)line_count - rows;
+        scroll = scroll > last ? last : scroll;
+        edit->scroll_line = scroll < 0 ? 0 : (UI_u64)scroll;
+    }
+    if (cursor_moved) {
+        /* Keep the cursor visible */
+        UI_u64 line = ui_text_line_of(edit, edit->cursor);
+        UI_u64 column = edit->cursor - ui_text_line_start(edit, line);
+        if (line < edit->scroll_line) edit->scroll_line = line;
+        if (rows > 0 && line >= edit->scroll_line + (UI_u64)rows) edit->scroll_line = line - (UI_u64)rows + 1;
+        if (column < edit->scroll_column) edit->scroll_column = column;
+        if (columns > 0 && column >= edit->scroll_column + (UI_u64)columns) edit->scroll_column = column - (UI_u64)columns + 1;
+    }
     /* Widget rendering */
-    if (ui_is_hot(id) && ui_mouse_inside_rect(pos, dim)) {
-        color = v4f(0.6f, 0.7f, 0.6f, 1.0f);
+    if (ui_state.focus == id) {
+        color = v4f(0.18f, 0.18f, 0.2f, 1.0f);
     }
-    if (*value) {
-        inner_color = v4f(0.7f, 1.0f, 0.7f, 1.0f);
+    ui_push_rounded_rect(pos, dim, 4.0f, color);
+    UI_u64 cursor_line = ui_text_line_of(edit, edit->cursor);
+    for (UI_i32 row = 0; row < rows && edit->scroll_line + (UI_u64)row < line_count; ++row) {
+        UI_u64 line = edit->scroll_line + (UI_u64)row;
+        UI_u64 start = ui_text_line_start(edit, line) + edit->scroll_column;
+        UI_u64 end = ui_text_line_end(edit, line);
+        UI_i32 glyph_y = text_pos.y + row*ui_font.glyph_height;
+        /* One span for the visible part of the line, blanks are given back */
+        UI_u64 visible_end = (end < start + (UI_u64)columns) ? end : start + (UI_u64)columns;
+        UI_DrawCmmd *glyphs = ui_draw_reserve(visible_end > start ? visible_end - start : 0);
+        for (UI_u64 at = start; at < visible_end; ++at) {
+            UI_u8 c = ui_text_char(edit, at);
+            if (c > 32) {
+                UI_i32 glyph_x = text_pos.x + (UI_i32)(at - start)*ui_font.glyph_width;
+                ui_write_glyph(glyphs++, v2i(glyph_x, glyph_y), c, text_color);
+            }
+        }
+        ui_draw_trim(glyphs);
+        if (ui_state.focus == id && line == cursor_line) {
+            UI_u64 column = edit->cursor - ui_text_line_start(edit, line);
+            if (column >= edit->scroll_column && column <= edit->scroll_column + (UI_u64)columns) {
+                UI_i32 cursor_x = text_pos.x + (UI_i32)(column - edit->scroll_column)*ui_font.glyph_width;
+                ui_push_rect(v2i(cursor_x, glyph_y), v2i(2, ui_font.glyph_height), cursor_color);
+            }
+        }
     }
-    ui_push_rect(pos, dim, color);
-    ui_push_rect(inner_pos, inner_dim, inner_color);
 }
 
-void ui_slider(void *id, float *value, int x, int y) {
+/* Wheel zooms around the mouse, dragging pans. Every pixel column is one vertical span
+   from the min to the max of its samples, zoomed in past one sample per pixel the
+   samples are joined with lines instead */
+void ui_plot(UI_Id key, UI_Plot *plot, int x, int y, int w, int h) {
+    UI_Id id = ui_id_resolve(key);
     /* Widget dimensions */
     UI_V2i pos = v2i(x, y);
-    UI_V2i dim = ui_default_slider_dim;
-    UI_V4f color = v4f(0.4f, 0.4f, 0.4f, 1.0f);
-    UI_f32 inner_offset_x = (((*value + 1.0f) / 2.0f) * dim.x);
-    UI_V2i inner_dim = v2i(20, dim.y);
-    UI_V2i inner_pos = v2i(pos.x + (UI_i32)inner_offset_x - (inner_dim.x/2), pos.y);
-    UI_V4f inner_color = v4f(0.7f, 0.7f, 0.7f, 1.0f);
+    UI_V2i dim = v2i(w, h);
+    UI_V4f color = v4f(0.15f, 0.15f, 0.15f, 1.0f);
+    UI_V4f line_color = v4f(0.6f, 0.7f, 0.6f, 1.0f);
+    UI_f64 count = (UI_f64)plot->count;
+    UI_b32 follow = plot->view_count <= 0.0 || plot->view_first + plot->view_count >= count - 1.0;
+    if (plot->view_count <= 0.0 || plot->view_count > count) {
+        plot->view_count = count;
+    }
+    if (follow) {
+        plot->view_first = count - plot->view_count;
+    }
     /* Widget logic */
     if (ui_is_hover(id)) {
         if (ui_is_active(id)) {
             if (ui_state.mouse_is_down) {
-                if (ui_is_hover(id) && ui_is_hot(id) && ui_mouse_inside_rect(pos, dim)) {
-                    *value = ((((UI_f32)(ui_state.mouse.x - pos.x) / dim.x) * 2) - 1);
-                }
+                plot->view_first -= (UI_f64)(ui_state.mouse.x - plot->drag_x) / (UI_f64)w * plot->view_count;
+                plot->drag_x = ui_state.mouse.x;
             }
             if (ui_state.mouse_went_up) {
                 ui_set_active(0);
             }
         } else if (ui_is_hot(id)) {
             if (ui_state.mouse_went_down) {
+                plot->drag_x = ui_state.mouse.x;
                 ui_set_active(id);
             }
         }
+        if (ui_state.mouse_wheel) {
+            UI_f64 anchor_t = (UI_f64)(ui_state.mouse.x - x) / (UI_f64)w;
+            UI_f64 anchor = plot->view_first + anchor_t*plot->view_count;
+            plot->view_count *= pow(0.8, (UI_f64)ui_state.mouse_wheel / (UI_f64)WHEEL_DELTA);
+            plot->view_count = plot->view_count < 2.0 ? 2.0 : (plot->view_count > count ? count : plot->view_count);
+            plot->view_first = anchor - anchor_t*plot->view_count;
+        }
         if (ui_mouse_inside_rect(pos, dim)) {
             ui_set_hot(id);
         }
@@ -488,77 +4365,735 @@ void ui_slider(void *id, float *value, int x, int y) {
     if (ui_mouse_inside_rect(pos, dim)) {
         ui_set_next_hover(id);
     }
-    /* Widget rendering*/
-    if (ui_is_hot(id) && ui_mouse_inside_rect(inner_pos, inner_dim)) {
-        inner_color = v4f(0.6f, 0.7f, 0.6f, 1.0f);
+    plot->view_first = plot->view_first < 0.0 ? 0.0 : plot->view_first;
+    plot->view_first = plot->view_first + plot->view_count > count ? count - plot->view_count : plot->view_first;
+    /* Widget rendering */
+    ui_push_rounded_rect(pos, dim, 4.0f, color);
+    if (plot->count < 2 || w < 1 || h < 3) {
+        return;
+    }
+    UI_u64 first = (UI_u64)plot->view_first;
+    UI_u64 last = (UI_u64)ceil(plot->view_first + plot->view_count);
+    last = last < plot->count ? last : plot->count;
+    UI_PlotRange bounds = ui_plot_range(plot, first, last);
+    UI_f32 scale = (bounds.max > bounds.min) ? (UI_f32)(h - 2) / (bounds.max - bounds.min) : 0.0f;
+    UI_f32 bottom = (UI_f32)(y + h - 1);
+    UI_f64 samples_per_pixel = plot->view_count / (UI_f64)w;
+    if (samples_per_pixel < 1.0) {
+        UI_DrawCmmd *segments = ui_draw_reserve(last > first + 1 ? last - first - 1 : 0);
+        for (UI_u64 i = first; i + 1 < last; ++i) {
+            UI_V2i a = v2i(x + (UI_i32)(((UI_f64)i - plot->view_first) / samples_per_pixel),
+                           (UI_i32)(bottom - (plot->samples[i] - bounds.min)*scale));
+            UI_V2i b = v2i(x + (UI_i32)(((UI_f64)(i + 1) - plot->view_first) / samples_per_pixel),
+                           (UI_i32)(bottom - (plot->samples[i + 1] - bounds.min)*scale));
+            ui_write_line(segments++, a, b, 1.5f, line_color);
+        }
+        return;
+    }
+    /* One command per pixel column, the columns past the last sample are given back */
+    UI_DrawCmmd *columns = ui_draw_reserve(w > 0 ? (UI_u64)w : 0);
+    UI_PlotRange previous = {0};
+    for (UI_i32 column = 0; column < w; ++column) {
+        UI_u64 column_first = (UI_u64)(plot->view_first + (UI_f64)column*samples_per_pixel);
+        UI_u64 column_last = (UI_u64)(plot->view_first + (UI_f64)(column + 1)*samples_per_pixel);
+        column_last = column_last > column_first ? column_last : column_first + 1;
+        UI_PlotRange range = ui_plot_range(plot, column_first, column_last);
+        if (range.min > range.max) {
+            break;
+        }
+        /* Overlap the previous column so the trace has no gaps */
+        if (column > 0) {
+            range.min = range.min > previous.max ? previous.max : range.min;
+            range.max = range.max < previous.min ? previous.min : range.max;
+        }
+        previous = range;
+        UI_i32 top = (UI_i32)(bottom - (range.max - bounds.min)*scale);
+        UI_i32 height = (UI_i32)((range.max - range.min)*scale) + 1;
+        ui_write_rect(columns++, v2i(x + column, top), v2i(1, height), line_color);
+    }
+    ui_draw_trim(columns);
+}
+
+/* Job step, counts one slice of samples and publishes the bins once every sample is in */
+UI_b32 ui_histogram_step(void *data) {
+    UI_Histogram *histogram = (UI_Histogram *)data;
+    UI_Plot *plot = histogram->plot;
+    UI_u64 end = histogram->work_next + UI_HISTOGRAM_SLICE;
+    end = end < histogram->work_count ? end : histogram->work_count;
+    UI_f32 min = histogram->work_range.min;
+    UI_f32 scale = (histogram->work_range.max > min) ? (UI_f32)UI_HISTOGRAM_BINS / (histogram->work_range.max - min) : 0.0f;
+    for (UI_u64 i = histogram->work_next; i < end; ++i) {
+        UI_i32 bin = (UI_i32)((plot->samples[i] - min)*scale);
+        bin = bin < UI_HISTOGRAM_BINS ? bin : UI_HISTOGRAM_BINS - 1;
+        ++histogram->work[bin];
+    }
+    histogram->work_next = end;
+    if (end < histogram->work_count) {
+        return FALSE;
+    }
+    memcpy(histogram->bins, histogram->work, sizeof(histogram->bins));
+    histogram->range = histogram->work_range;
+    histogram->source_count = histogram->work_count;
+    return TRUE;
+}
+
+/* Recounts in the background whenever the plot has new samples */
+void ui_histogram(UI_Id key, UI_Histogram *histogram, UI_Plot *plot, int x, int y, int w, int h) {
+    UI_Id id = ui_id_resolve(key);
+    UI_V2i pos = v2i(x, y);
+    UI_V2i dim = v2i(w, h);
+    UI_V4f color = v4f(0.15f, 0.15f, 0.15f, 1.0f);
+    UI_V4f bar_color = v4f(0.6f, 0.6f, 0.7f, 1.0f);
+    UI_V4f progress_color = v4f(0.8f, 0.6f, 0.3f, 1.0f);
+    UI_b32 pending = ui_job_pending(id);
+    if (!pending && plot->count && plot->count != histogram->source_count) {
+        histogram->plot = plot;
+        histogram->work_count = plot->count;
+        histogram->work_next = 0;
+        histogram->work_range = ui_plot_range(plot, 0, plot->count);
+        memset(histogram->work, 0, sizeof(histogram->work));
+        pending = ui_job_submit(id, ui_histogram_step, histogram);
+    }
+    ui_push_rounded_rect(pos, dim, 4.0f, color);
+    UI_u32 peak = 0;
+    for (UI_u32 i = 0; i < UI_HISTOGRAM_BINS; ++i) {
+        peak = histogram->bins[i] > peak ? histogram->bins[i] : peak;
+    }
+    if (peak) {
+        UI_f32 bar_width = (UI_f32)w / (UI_f32)UI_HISTOGRAM_BINS;
+        for (UI_u32 i = 0; i < UI_HISTOGRAM_BINS; ++i) {
+            UI_i32 height = (UI_i32)((UI_f32)(h - 4)*(UI_f32)histogram->bins[i] / (UI_f32)peak);
+            UI_i32 left = x + (UI_i32)(bar_width*(UI_f32)i);
+            UI_i32 right = x + (UI_i32)(bar_width*(UI_f32)(i + 1));
+            ui_push_rect(v2i(left, y + h - 2 - height), v2i(ui_i32_max(right - left - 1, 1), height), bar_color);
+        }
+    }
+    if (pending && histogram->work_count) {
+        UI_i32 done = (UI_i32)((UI_f64)w*(UI_f64)histogram->work_next / (UI_f64)histogram->work_count);
+        ui_push_rect(v2i(x, y + h - 2), v2i(done, 2), progress_color);
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Render thread: texture of an image the UI thread had no texture for when it built the list.
+   The pixels are only read, the texture is recorded in the list for the UI thread */
+GLuint ui_gl_upload_image(UI_DrawList *list, UI_ImageEntry *image) {
+    for (UI_u32 i = 0; i < list->upload_count; ++i) {
+        if (list->upload_images[i] == image) {
+            return list->uploads[i];
+        }
+    }
+    if (list->upload_count == UI_RENDER_UPLOAD_MAX) {
+        return 0;
+    }
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image->width, image->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image->pixels);
+    list->upload_images[list->upload_count] = image;
+    list->upload_keys[list->upload_count] = image->key;
+    list->uploads[list->upload_count] = texture;
+    ++list->upload_count;
+    return texture;
+}
+
+void ui_draw_cmmds(UI_DrawList *list, UI_DrawCmmd *draw_cmmd_buffer, UI_u64 draw_cmmd_buffer_count) {
+    if (!draw_cmmd_buffer_count) {
+        return;
+    }
+    ui_quads_expand(draw_cmmd_buffer, draw_cmmd_buffer_count, 0,
+                    draw_vertex_buffer, draw_color_buffer, draw_index_buffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    ui_prims_expand_params(draw_cmmd_buffer, draw_cmmd_buffer_count, draw_shape_buffer, draw_param_buffer);
+    glEnableVertexAttribArray(UI_PRIM_ATTRIB_SHAPE);
+    glEnableVertexAttribArray(UI_PRIM_ATTRIB_PARAM);
+    glVertexPointer(2, GL_INT, 0, draw_vertex_buffer);
+    glColorPointer(4, GL_FLOAT, 0, draw_color_buffer);
+    glVertexAttribPointer(UI_PRIM_ATTRIB_SHAPE, 4, GL_FLOAT, GL_FALSE, 0, draw_shape_buffer);
+    glVertexAttribPointer(UI_PRIM_ATTRIB_PARAM, 4, GL_FLOAT, GL_FALSE, 0, draw_param_buffer);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); /* the shader outputs premultiplied alpha */
+    glUseProgram(global_prim_program);
+    /* One draw call per run of commands that share the same image or layer */
+    UI_u64 batch_first = 0;
+    for (UI_u64 i = 1; i <= draw_cmmd_buffer_count; ++i) {
+        if (i == draw_cmmd_buffer_count || draw_cmmd_buffer[i].image != draw_cmmd_buffer[batch_first].image ||
+            draw_cmmd_buffer[i].texture != draw_cmmd_buffer[batch_first].texture) {
+            GLuint texture = draw_cmmd_buffer[batch_first].texture;
+            if (!texture && draw_cmmd_buffer[batch_first].image) {
+                texture = ui_gl_upload_image(list, draw_cmmd_buffer[batch_first].image);
+            }
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glDrawElements(GL_TRIANGLES, (GLsizei)((i - batch_first)*6), GL_UNSIGNED_INT, draw_index_buffer + batch_first*6);
+            batch_first = i;
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+    glDisable(GL_BLEND);
+    glDisableVertexAttribArray(UI_PRIM_ATTRIB_PARAM);
+    glDisableVertexAttribArray(UI_PRIM_ATTRIB_SHAPE);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+UI_Layer *ui_layer_get(UI_Id id) {
+    for (UI_u32 i = 0; i < ui_render.layer_cache_count; ++i) {
+        if (ui_render.layer_cache[i].id == id) {
+            return ui_render.layer_cache + i;
+        }
+    }
+    if (ui_render.layer_cache_count < UI_LAYER_CACHE_MAX) {
+        UI_Layer *layer = ui_render.layer_cache + ui_render.layer_cache_count++;
+        memset(layer, 0, sizeof(UI_Layer));
+        layer->id = id;
+        return layer;
+    }
+    /* Full, take over the least recently composited layer */
+    UI_Layer *oldest = ui_render.layer_cache;
+    for (UI_u32 i = 1; i < ui_render.layer_cache_count; ++i) {
+        if (ui_render.layer_cache[i].last_used < oldest->last_used) {
+            oldest = ui_render.layer_cache + i;
+        }
+    }
+    oldest->id = id;
+    oldest->hash = 0;
+    return oldest;
+}
+
+void ui_layer_release(UI_Layer *layer) {
+    glDeleteFramebuffers(1, &layer->framebuffer);
+    glDeleteTextures(1, &layer->texture);
+    layer->framebuffer = 0;
+    layer->texture = 0;
+}
+
+/* Draw the layer commands into its texture, cleared to transparent black so the
+   premultiplied result composites correctly over whatever is below the window */
+void ui_layer_render(UI_Layer *layer, UI_DrawList *list, UI_DrawLayer *draw_layer) {
+    if (!layer->texture || layer->dim.x != draw_layer->dim.x || layer->dim.y != draw_layer->dim.y) {
+        if (layer->texture) {
+            ui_layer_release(layer);
+        }
+        layer->dim = draw_layer->dim;
+        glGenTextures(1, &layer->texture);
+        glBindTexture(GL_TEXTURE_2D, layer->texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, layer->dim.x, layer->dim.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenFramebuffers(1, &layer->framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, layer->framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, layer->texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("Error: Cannot create window layer framebuffer\n");
+            exit(-1);
+        }
+    } else {
+        glBindFramebuffer(GL_FRAMEBUFFER, layer->framebuffer);
+    }
+    glViewport(0, 0, layer->dim.x, layer->dim.y);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    /* Bottom up so the first texture row is the top of the window, like the images */
+    glOrtho(0, layer->dim.x, 0, layer->dim.y, 0, 1);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    ui_draw_cmmds(list, list->cmmds + draw_layer->first, draw_layer->count);
+    glPopMatrix();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, ui_render.viewport_width, ui_render.viewport_height);
+    layer->hash = draw_layer->hash;
+}
+
+/* Commands outside of the layers are drawn in order, every layer is re-rendered only
+   when its content changed and then composited with one quad */
+void ui_draw_draw_cmmd_buffer(UI_DrawList *list) {
+    UI_u64 cursor = 0;
+    for (UI_u32 i = 0; i < list->layer_count; ++i) {
+        UI_DrawLayer *draw_layer = list->layers + i;
+        ui_draw_cmmds(list, list->cmmds + cursor, draw_layer->first - cursor);
+        cursor = draw_layer->first + draw_layer->count;
+        if (draw_layer->dim.x <= 0 || draw_layer->dim.y <= 0) {
+            continue;
+        }
+        UI_Layer *layer = ui_layer_get(draw_layer->id);
+        if (layer->texture && layer->hash == draw_layer->hash) {
+            ++ui_render.layer_hits;
+        } else {
+            ui_layer_render(layer, list, draw_layer);
+            ++ui_render.layer_renders;
+        }
+        layer->last_used = ui_render.frames_presented;
+        UI_DrawCmmd composite;
+        memset(&composite, 0, sizeof(UI_DrawCmmd));
+        composite.type = UI_DRAW_CMMD_LAYER;
+        composite.pos = draw_layer->pos;
+        composite.dim = draw_layer->dim;
+        composite.color = v4f(1.0f, 1.0f, 1.0f, 1.0f);
+        composite.texture = layer->texture;
+        ui_draw_cmmds(list, &composite, 1);
+    }
+    ui_draw_cmmds(list, list->cmmds + cursor, list->count - cursor);
+
+    /* Release the layers of windows that are gone */
+    for (UI_u32 i = 0; i < ui_render.layer_cache_count;) {
+        UI_Layer *layer = ui_render.layer_cache + i;
+        if (layer->last_used + UI_LAYER_KEEP_FRAMES < ui_render.frames_presented) {
+            ui_layer_release(layer);
+            *layer = ui_render.layer_cache[--ui_render.layer_cache_count];
+        } else {
+            ++i;
+        }
     }
-    ui_push_rect(pos, dim, color);
-    ui_push_rect(inner_pos, inner_dim, inner_color);
 }
 
 /* ------------------------------------------------------------------------ */
+/* Render pipeline */
+
+/* Busy wait used to simulate an expensive stage */
+void ui_debug_spin(UI_f64 milliseconds) {
+    UI_i64 end = ui_time_now() + (UI_i64)(milliseconds*0.001*(UI_f64)ui_scheduler.frequency);
+    while (ui_time_now() < end) {
+        YieldProcessor();
+    }
+}
+
+/* UI thread: start building into the back list, retired textures of a dropped list are kept.
+   Textures uploaded while the list was rendered go to their images, an image that got one
+   from another list meanwhile, was evicted or whose slot was reused retires it */
+void ui_render_begin_frame(void) {
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    for (UI_u32 i = 0; i < list->upload_count; ++i) {
+        UI_ImageEntry *image = list->upload_images[i];
+        if (image->key == list->upload_keys[i] && image->state == UI_IMAGE_READY && !image->texture) {
+            image->texture = list->uploads[i];
+            image->texture_frame = ui_image_cache.frame;
+            image->state = UI_IMAGE_UPLOADED;
+        } else {
+            ASSERT(list->retired_count < UI_RENDER_RETIRE_MAX);
+            list->retired[list->retired_count++] = list->uploads[i];
+        }
+    }
+    list->upload_count = 0;
+    list->count = 0;
+    list->layer_count = 0;
+    list->frame = ui_image_cache.frame;
+    ui_debug_spin(UI_DEBUG_BUILD_LOAD_MS);
+}
+
+/* UI thread: hand the finished back list to the render thread and take the spare one */
+void ui_render_publish(void) {
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    list->frame_input = ui_scheduler.frame_input;
+    list->publish_time = ui_time_now();
+    ui_scheduler.frame_input = 0;
+    LONG previous = InterlockedExchange(&ui_render.ready, (LONG)ui_render.build_index | UI_RENDER_FRESH);
+    if (previous & UI_RENDER_FRESH) {
+        /* The render thread never saw the previous frame, this one replaces it */
+        ++ui_render.frames_dropped;
+    }
+    ui_render.build_index = (UI_u32)(previous & ~UI_RENDER_FRESH);
+    /* The list that came back carries the timing of its present, the wait for the next frame
+       uses it. Lists come back in present order, a dropped one was never presented */
+    UI_DrawList *back = ui_render.lists + ui_render.build_index;
+    if (back->presented && back->clock.last_present > ui_scheduler.last_present) {
+        ui_scheduler.last_present = back->clock.last_present;
+        ui_scheduler.frame_period = back->clock.frame_period;
+        ui_scheduler.render_cost = back->clock.render_cost;
+    }
+    back->presented = FALSE;
+    ++ui_render.frames_built;
+    SetEvent(ui_render.wake);
+}
+
+/* Render thread: pick up the newest list if there is one, submit it and present */
+UI_b32 ui_render_frame(HDC device_context) {
+    if (!(ui_render.ready & UI_RENDER_FRESH)) {
+        return FALSE;
+    }
+    LONG ready = InterlockedExchange(&ui_render.ready, (LONG)ui_render.render_index);
+    ui_render.render_index = (UI_u32)(ready & ~UI_RENDER_FRESH);
+    UI_DrawList *list = ui_render.lists + ui_render.render_index;
+    InterlockedExchange64(&ui_render.render_frame, (LONG64)list->frame);
+    UI_i64 begin = ui_time_now();
+
+    if (list->retired_count) {
+        glDeleteTextures((GLsizei)list->retired_count, list->retired);
+        list->retired_count = 0;
+    }
+    if (ui_render.viewport_width != ui_render.width || ui_render.viewport_height != ui_render.height) {
+        ui_render.viewport_width = ui_render.width;
+        ui_render.viewport_height = ui_render.height;
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        glOrtho(0, ui_render.viewport_width, ui_render.viewport_height, 0, 0, 1);
+        glViewport(0, 0, ui_render.viewport_width, ui_render.viewport_height);
+    }
+    ui_debug_spin(UI_DEBUG_RENDER_LOAD_MS);
+
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    ui_draw_draw_cmmd_buffer(list);
+    ui_scheduler_track_cost(&ui_render.clock.render_cost, ui_time_seconds(ui_time_now() - begin));
 
-void ui_draw_draw_cmmd_buffer(void) {
-    for (UI_u64 i = 0; i < draw_cmmd_buffer_count; ++i) {
-        UI_DrawCmmd cmmd = draw_cmmd_buffer[i];
-        UI_RectMesh r = ui_rect_get_mesh(cmmd.pos, cmmd.dim);
+    SwapBuffers(device_context);
+    ui_scheduler_present(&ui_render.clock, list->frame_input);
+    ui_render.publish_to_present += ui_time_seconds(ui_render.clock.last_present - list->publish_time);
+    list->clock = ui_render.clock;
+    list->presented = TRUE;
+    ++ui_render.frames_presented;
+    return TRUE;
+}
+
+DWORD WINAPI ui_render_thread_proc(LPVOID param) {
+    (void)param;
+    HDC device_context = GetDC(ui_render.window);
+    wglMakeCurrent(device_context, global_gl_context);
+    while (ui_render.running) {
+        /* Only sleeps while there is nothing new, a publish during a frame leaves the event set */
+        WaitForSingleObject(ui_render.wake, 100);
+        ui_render_frame(device_context);
+    }
+    wglMakeCurrent(0, 0);
+    ReleaseDC(ui_render.window, device_context);
+    return 0;
+}
+
+void ui_render_init(HWND window) {
+    ui_render.window = window;
+    ui_render.build_index = 0;
+    ui_render.ready = 1;
+    ui_render.render_index = 2;
+    ui_render.start_time = ui_time_now();
+    ui_render.clock.last_present = ui_scheduler.last_present;
+    ui_render.clock.frame_period = ui_scheduler.frame_period;
+    ui_render.clock.render_cost = ui_scheduler.render_cost;
+    ui_render.wake = CreateEventA(0, FALSE, FALSE, 0);
+#if UI_RENDER_THREAD
+    /* The context was created on this thread, hand it over */
+    wglMakeCurrent(0, 0);
+    ui_render.running = TRUE;
+    ui_render.thread = CreateThread(0, 0, ui_render_thread_proc, 0, 0, 0);
+#endif
+}
+
+void ui_render_quit(void) {
+#if UI_RENDER_THREAD
+    ui_render.running = FALSE;
+    SetEvent(ui_render.wake);
+    WaitForSingleObject(ui_render.thread, INFINITE);
+    CloseHandle(ui_render.thread);
+    HDC device_context = GetDC(ui_render.window);
+    wglMakeCurrent(device_context, global_gl_context);
+    ReleaseDC(ui_render.window, device_context);
+#endif
+    CloseHandle(ui_render.wake);
+
+    UI_f64 seconds = ui_time_seconds(ui_time_now() - ui_render.start_time);
+    printf("render pipeline (%s, build load %d ms, render load %d ms)\n",
+           UI_RENDER_THREAD ? "threaded" : "serial", UI_DEBUG_BUILD_LOAD_MS, UI_DEBUG_RENDER_LOAD_MS);
+    printf("  built %llu frames (%.1f/s), presented %llu (%.1f/s), dropped %llu\n",
+           ui_render.frames_built, (UI_f64)ui_render.frames_built/seconds,
+           ui_render.frames_presented, (UI_f64)ui_render.frames_presented/seconds, ui_render.frames_dropped);
+    if (ui_render.frames_presented) {
+        printf("  publish to present: %.2f ms average\n",
+               ui_render.publish_to_present*1000.0/(UI_f64)ui_render.frames_presented);
+    }
+    printf("  window layers: %llu cache hits, %llu re-renders\n", ui_render.layer_hits, ui_render.layer_renders);
+}
+
+/* Demo producer thread, streams plot samples through a channel and publishes its state to cells */
+typedef struct UI_DemoTelemetry {
+    UI_Channel samples;
+    UI_ValueCell load;
+    UI_ValueCell online;
+    HANDLE thread;
+    volatile LONG running;
+} UI_DemoTelemetry;
+
+static UI_DemoTelemetry ui_demo_telemetry;
 
-        glBegin(GL_TRIANGLES);
-        /* Set rect color */
-        glColor3f(cmmd.color.x, cmmd.color.y, cmmd.color.z);
-        /* TODO: we can render trinagle for the ui in a for loop */
+UI_f32 ui_demo_telemetry_sample(UI_f64 phase) {
+    return (UI_f32)(sin(phase*0.001) + sin(phase*0.037)*0.2) + (UI_f32)(rand() % 1000)*0.0002f;
+}
 
-        /* First triangle */
-        glVertex3i(r.t[0].v[0].x, r.t[0].v[0].y, 0);
-        glVertex3i(r.t[0].v[1].x, r.t[0].v[1].y, 0);
-        glVertex3i(r.t[0].v[2].x, r.t[0].v[2].y, 0);
-        /* Second triangle */
-        glVertex3i(r.t[1].v[0].x, r.t[1].v[0].y, 0);
-        glVertex3i(r.t[1].v[1].x, r.t[1].v[1].y, 0);
-        glVertex3i(r.t[1].v[2].x, r.t[1].v[2].y, 0);
+DWORD WINAPI ui_demo_telemetry_proc(LPVOID param) {
+    (void)param;
+    UI_f64 phase = 1000000.0;
+    UI_u32 tick = 0;
+    while (ui_demo_telemetry.running) {
+        /* Bursts of 50 ms, the UI only builds frames when a burst arrives */
+        Sleep(50);
+        for (UI_u32 i = 0; i < 768; ++i) {
+            UI_f32 sample = ui_demo_telemetry_sample(phase);
+            ui_channel_push(&ui_demo_telemetry.samples, &sample);
+            phase += 1.0;
+        }
+        float load = (float)sin(phase*0.0001);
+        ui_cell_publish(&ui_demo_telemetry.load, &load);
+        UI_b32 online = ((++tick / 40) & 1) == 0;
+        ui_cell_publish(&ui_demo_telemetry.online, &online);
+    }
+    return 0;
+}
 
-        glEnd();
+void ui_demo_telemetry_start(void) {
+    ui_channel_init(&ui_demo_telemetry.samples, sizeof(UI_f32), 1 << 20, FALSE);
+    float load = 0.0f;
+    UI_b32 online = TRUE;
+    ui_cell_init(&ui_demo_telemetry.load, sizeof(float), &load);
+    ui_cell_init(&ui_demo_telemetry.online, sizeof(UI_b32), &online);
+    /* History before the thread starts */
+    for (UI_u32 i = 0; i < 1000000; ++i) {
+        UI_f32 sample = ui_demo_telemetry_sample((UI_f64)i);
+        ui_channel_push(&ui_demo_telemetry.samples, &sample);
     }
-    draw_cmmd_buffer_count = 0;
+    ui_demo_telemetry.running = TRUE;
+    ui_demo_telemetry.thread = CreateThread(0, 0, ui_demo_telemetry_proc, 0, 0, 0);
+}
+
+void ui_demo_telemetry_stop(void) {
+    ui_demo_telemetry.running = FALSE;
+    WaitForSingleObject(ui_demo_telemetry.thread, INFINITE);
+    CloseHandle(ui_demo_telemetry.thread);
+    printf("telemetry: %lld samples dropped\n", ui_demo_telemetry.samples.dropped);
+    ui_channel_free(&ui_demo_telemetry.samples);
+    ui_cell_free(&ui_demo_telemetry.load);
+    ui_cell_free(&ui_demo_telemetry.online);
 }
 
 void main_loop(HWND window) {
-    HDC device_context = GetDC(window);
+    ui_scheduler_begin_build();
+    ui_render_begin_frame();
 
     char *button_name = "button";
-    if(ui_button((void *)(button_name + 0), button_name, 100, 50)) {
+    if(ui_button(UI_ID("button"), button_name, 100, 50)) {
         printf("button: %d pressed\n", 1);
     }
 
-    ui_begin_window((void *)(button_name + 1), 100, 200);
-    if(ui_button((void *)(button_name + 2), button_name, 16, 16)) {
-        printf("button: %d pressed\n", 2);
-    }
-    if(ui_button((void *)(button_name + 3), button_name, 16, 16)) {
-        printf("button: %d pressed\n", 3);
-    }
-    if(ui_button((void *)(button_name + 4), button_name, 16, 16)) {
-        printf("button: %d pressed\n", 4);
+    /* Same key in a loop, the id stack keeps every button unique */
+    ui_begin_window(UI_ID("window"), 100, 200);
+    for (int i = 0; i < 4; ++i) {
+        ui_push_id(ui_id_int(i));
+        if(ui_button(UI_ID("button"), button_name, 16, 16)) {
+            printf("button: %d pressed\n", i + 2);
+        }
+        ui_pop_id();
     }
-    if(ui_button((void *)(button_name + 5), button_name, 16, 16)) {
-        printf("button: %d pressed\n", 5);
+    ui_end_window();
+
+    /* Click a window to raise it, drag it by the background or by the grip in the corner */
+    ui_begin_window(UI_ID("window 2"), 180, 260);
+    for (int i = 0; i < 2; ++i) {
+        ui_push_id(ui_id_int(i));
+        ui_button(UI_ID("button"), button_name, 0, 0);
+        ui_pop_id();
     }
     ui_end_window();
 
+#if UI_WINDOW_BENCHMARK
+    for (int i = 0; i < UI_WINDOW_BENCHMARK; ++i) {
+        ui_push_id(ui_id_int(i));
+        ui_begin_window(UI_ID("benchmark window"), 20 + (i % 32)*22, 20 + (i / 32)*40);
+        ui_button(UI_ID("a"), button_name, 0, 0);
+        ui_button(UI_ID("b"), button_name, 0, 0);
+        /* One window a frame comes to the front */
+        UI_Window *window = ui_state.window_current;
+        ui_end_window();
+        ui_pop_id();
+        if ((UI_u64)i == ui_state.frame % UI_WINDOW_BENCHMARK) {
+            ui_window_raise(window);
+        }
+    }
+    ui_request_redraw();
+#endif
+
     static UI_b32 checked = 0;
-    ui_checkbox((void *)&checked, &checked, 400, 50);
+    ui_checkbox(UI_ID("checkbox"), &checked, 400, 50);
     static float value = 0.0f;
-    ui_slider((void  *)&value, &value, 400, 100);
+    ui_slider(UI_ID("slider"), &value, 400, 100);
+
+    static UI_TextEdit text;
+    if (!text.blocks && !ui_text_load(&text, "ui_text_demo.txt")) {
+        char *sample = "Text edit\nClick to focus, type to insert.\nArrows, Home/End, PgUp/PgDn and the wheel scroll.\n";
+        ui_text_init(&text, (UI_u8 *)sample, strlen(sample));
+    }
+    ui_text_edit(UI_ID("text"), &text, 420, 150, 360, 300);
+
+    /* A million samples of a noisy wave, new samples keep streaming in from the telemetry thread */
+    static UI_Plot plot;
+    ui_plot_drain(&plot, &ui_demo_telemetry.samples);
+    ui_plot(UI_ID("plot"), &plot, 20, 470, 380, 110);
+    ui_label(ui_frame_format("%llu samples", plot.count), 20, 470 - ui_font.glyph_height - 2, v4f(0.8f, 0.8f, 0.8f, 1.0f));
+    ui_checkbox_cell(UI_ID("online"), &ui_demo_telemetry.online, 440, 50);
+
+    /* Screen compiled from screen.ui, shown once it has been compiled to screen.uib */
+    static UI_Screen screen;
+    static UI_b32 screen_tried = FALSE;
+    if (!screen_tried) {
+        screen_tried = TRUE;
+        ui_screen_load(&screen, "screen.uib");
+    }
+    ui_screen_frame(&screen);
+    UI_ScreenValue *reset = ui_screen_value(&screen, UI_ID("reset"));
+    if (reset && reset->pressed) {
+        printf("screen: reset pressed\n");
+    }
+    ui_slider_cell(UI_ID("load"), &ui_demo_telemetry.load, 400, 125);
+    static UI_Histogram histogram;
+    ui_histogram(UI_ID("histogram"), &histogram, &plot, 420, 470, 360, 110);
     
     ui_update();
-    
-    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    ui_jobs_run();
+    ui_scheduler_end_build();
+    ui_render_publish();
 
-    ui_draw_draw_cmmd_buffer();
-
-    SwapBuffers(device_context);
+#if !UI_RENDER_THREAD
+    HDC device_context = GetDC(window);
+    ui_render_frame(device_context);
     ReleaseDC(window, device_context);
+#endif
+}
+
+/* Signed distance based coverage for every primitive type, one pass per pixel */
+static char *ui_prim_vertex_shader =
+    "#version 110\n"
+    "attribute vec4 a_shape;\n"
+    "attribute vec4 a_param;\n"
+    "varying vec2 v_pos;\n"
+    "varying vec4 v_shape;\n"
+    "varying vec4 v_param;\n"
+    "void main() {\n"
+    "    v_pos = gl_Vertex.xy;\n"
+    "    v_shape = a_shape;\n"
+    "    v_param = a_param;\n"
+    "    gl_FrontColor = gl_Color;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;\n"
+    "}\n";
+
+static char *ui_prim_fragment_shader =
+    "#version 110\n"
+    "varying vec2 v_pos;\n"
+    "varying vec4 v_shape;\n"
+    "varying vec4 v_param;\n"
+    "uniform sampler2D u_texture;\n"
+    "float sd_rounded_rect(vec2 p, vec2 center, vec2 half_dim, float radius) {\n"
+    "    vec2 q = abs(p - center) - half_dim + radius;\n"
+    "    return length(max(q, 0.0)) + min(max(q.x, q.y), 0.0) - radius;\n"
+    "}\n"
+    "float sd_segment(vec2 p, vec2 a, vec2 b) {\n"
+    "    vec2 pa = p - a;\n"
+    "    vec2 ba = b - a;\n"
+    "    float t = clamp(dot(pa, ba) / max(dot(ba, ba), 0.0001), 0.0, 1.0);\n"
+    "    return length(pa - ba*t);\n"
+    "}\n"
+    "void main() {\n"
+    "    float radius = v_param.x;\n"
+    "    float thickness = v_param.y;\n"
+    "    float type = v_param.z;\n"
+    "    vec2 center = (v_shape.xy + v_shape.zw) * 0.5;\n"
+    "    vec2 half_dim = (v_shape.zw - v_shape.xy) * 0.5;\n"
+    "    float d;\n"
+    "    if (type < 1.5) {\n"
+    "        d = sd_rounded_rect(v_pos, center, half_dim, radius);\n"
+    "    } else if (type < 2.5) {\n"
+    "        float half_thickness = thickness * 0.5;\n"
+    "        d = abs(sd_rounded_rect(v_pos, center, half_dim - half_thickness, max(radius - half_thickness, 0.0))) - half_thickness;\n"
+    "    } else if (type < 3.5) {\n"
+    "        d = sd_segment(v_pos, v_shape.xy, v_shape.zw) - radius;\n"
+    "    } else {\n"
+    "        d = sd_rounded_rect(v_pos, center, half_dim, radius);\n"
+    "    }\n"
+    "    float coverage = clamp(0.5 - d, 0.0, 1.0);\n"
+    "    vec2 uv = (v_pos - v_shape.xy) / (v_shape.zw - v_shape.xy);\n"
+    "    if (type > 5.5) {\n"
+    "        /* Glyph coverage from its cell in the 16x16 font atlas */\n"
+    "        vec2 cell = vec2(mod(v_param.w, 16.0), floor(v_param.w / 16.0));\n"
+    "        float alpha = gl_Color.a * texture2D(u_texture, (cell + uv) / 16.0).a;\n"
+    "        gl_FragColor = vec4(gl_Color.rgb * alpha, alpha);\n"
+    "        return;\n"
+    "    }\n"
+    "    if (type > 4.5) {\n"
+    "        /* Window layers are already premultiplied, the color alpha is the layer opacity */\n"
+    "        gl_FragColor = texture2D(u_texture, uv) * (gl_Color.a * coverage);\n"
+    "        return;\n"
+    "    }\n"
+    "    vec4 color = gl_Color;\n"
+    "    if (type > 3.5) {\n"
+    "        color *= texture2D(u_texture, uv);\n"
+    "    }\n"
+    "    /* Premultiplied output, blended with ONE, ONE_MINUS_SRC_ALPHA */\n"
+    "    float alpha = color.a * coverage;\n"
+    "    gl_FragColor = vec4(color.rgb * alpha, alpha);\n"
+    "}\n";
+
+GLuint ui_gl_compile_shader(GLenum type, char *source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, (const GLchar **)&source, 0);
+    glCompileShader(shader);
+    GLint status = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), 0, log);
+        printf("Error: Cannot compile shader\n%s\n", log);
+        exit(-1);
+    }
+    return shader;
+}
+
+void ui_gl_load_prim_program(void) {
+    glCreateShader = (PFNGLCREATESHADERPROC)wglGetProcAddress("glCreateShader");
+    glShaderSource = (PFNGLSHADERSOURCEPROC)wglGetProcAddress("glShaderSource");
+    glCompileShader = (PFNGLCOMPILESHADERPROC)wglGetProcAddress("glCompileShader");
+    glGetShaderiv = (PFNGLGETSHADERIVPROC)wglGetProcAddress("glGetShaderiv");
+    glGetShaderInfoLog = (PFNGLGETSHADERINFOLOGPROC)wglGetProcAddress("glGetShaderInfoLog");
+    glCreateProgram = (PFNGLCREATEPROGRAMPROC)wglGetProcAddress("glCreateProgram");
+    glAttachShader = (PFNGLATTACHSHADERPROC)wglGetProcAddress("glAttachShader");
+    glBindAttribLocation = (PFNGLBINDATTRIBLOCATIONPROC)wglGetProcAddress("glBindAttribLocation");
+    glLinkProgram = (PFNGLLINKPROGRAMPROC)wglGetProcAddress("glLinkProgram");
+    glGetProgramiv = (PFNGLGETPROGRAMIVPROC)wglGetProcAddress("glGetProgramiv");
+    glUseProgram = (PFNGLUSEPROGRAMPROC)wglGetProcAddress("glUseProgram");
+    glVertexAttribPointer = (PFNGLVERTEXATTRIBPOINTERPROC)wglGetProcAddress("glVertexAttribPointer");
+    glEnableVertexAttribArray = (PFNGLENABLEVERTEXATTRIBARRAYPROC)wglGetProcAddress("glEnableVertexAttribArray");
+    glDisableVertexAttribArray = (PFNGLDISABLEVERTEXATTRIBARRAYPROC)wglGetProcAddress("glDisableVertexAttribArray");
+    if (!glCreateShader || !glShaderSource || !glCompileShader || !glGetShaderiv || !glGetShaderInfoLog ||
+        !glCreateProgram || !glAttachShader || !glBindAttribLocation || !glLinkProgram || !glGetProgramiv ||
+        !glUseProgram || !glVertexAttribPointer || !glEnableVertexAttribArray || !glDisableVertexAttribArray) {
+        printf("Error: Cannot load OpenGL 2.0 shader functions\n");
+        exit(-1);
+    }
+    glGenFramebuffers = (PFNGLGENFRAMEBUFFERSPROC)wglGetProcAddress("glGenFramebuffers");
+    glDeleteFramebuffers = (PFNGLDELETEFRAMEBUFFERSPROC)wglGetProcAddress("glDeleteFramebuffers");
+    glBindFramebuffer = (PFNGLBINDFRAMEBUFFERPROC)wglGetProcAddress("glBindFramebuffer");
+    glFramebufferTexture2D = (PFNGLFRAMEBUFFERTEXTURE2DPROC)wglGetProcAddress("glFramebufferTexture2D");
+    glCheckFramebufferStatus = (PFNGLCHECKFRAMEBUFFERSTATUSPROC)wglGetProcAddress("glCheckFramebufferStatus");
+    if (!glGenFramebuffers || !glDeleteFramebuffers || !glBindFramebuffer || !glFramebufferTexture2D ||
+        !glCheckFramebufferStatus) {
+        printf("Error: Cannot load OpenGL framebuffer object functions\n");
+        exit(-1);
+    }
+
+    GLuint vertex_shader = ui_gl_compile_shader(GL_VERTEX_SHADER, ui_prim_vertex_shader);
+    GLuint fragment_shader = ui_gl_compile_shader(GL_FRAGMENT_SHADER, ui_prim_fragment_shader);
+    global_prim_program = glCreateProgram();
+    glAttachShader(global_prim_program, vertex_shader);
+    glAttachShader(global_prim_program, fragment_shader);
+    glBindAttribLocation(global_prim_program, UI_PRIM_ATTRIB_SHAPE, "a_shape");
+    glBindAttribLocation(global_prim_program, UI_PRIM_ATTRIB_PARAM, "a_param");
+    glLinkProgram(global_prim_program);
+    GLint status = 0;
+    glGetProgramiv(global_prim_program, GL_LINK_STATUS, &status);
+    if (!status) {
+        printf("Error: Cannot link primitive shader program\n");
+        exit(-1);
+    }
 }
 
 void create_opengl_context(HWND hwnd) {
@@ -588,6 +5123,8 @@ void create_opengl_context(HWND hwnd) {
         exit(-1);
     }
     wglSwapIntervalEXT(1);
+
+    ui_gl_load_prim_program();
 }
 
 LRESULT CALLBACK win32_proc(HWND window, UINT message, WPARAM wparam, LPARAM lparam) {
@@ -598,15 +5135,15 @@ LRESULT CALLBACK win32_proc(HWND window, UINT message, WPARAM wparam, LPARAM lpa
             create_opengl_context(window);
         } break;
         case WM_SIZE: {
-            unsigned int width = LOWORD(lparam);
-            unsigned int height = HIWORD(lparam);
-            glMatrixMode(GL_PROJECTION);
-            glLoadIdentity();
-            glOrtho(0, width, height, 0, 0, 1);
-            glViewport(0, 0, width, height);
+            ui_request_redraw();
+            /* The projection is set by the thread that renders on its next frame */
+            InterlockedExchange(&ui_render.width, (LONG)LOWORD(lparam));
+            InterlockedExchange(&ui_render.height, (LONG)HIWORD(lparam));
         } break;
         case WM_PAINT: {
-            main_loop(window);
+            /* The frame is built by the main loop, an unvalidated window would get WM_PAINT forever */
+            ValidateRect(window, 0);
+            ui_request_redraw();
         } break;
         case WM_DESTROY: {
             global_running = 0;
@@ -622,7 +5159,221 @@ LRESULT CALLBACK win32_proc(HWND window, UINT message, WPARAM wparam, LPARAM lpa
     return result;
 }
 
-int main(void) {
+#if UI_DRAW_BENCHMARK
+/* A command built on the stack and copied in by value, what every ui_push_ function used to do,
+   against ui_push_rect writing in place and a whole span reserved at once */
+void ui_draw_benchmark(void) {
+    enum { frames = 200 };
+    UI_u32 count = UI_DRAW_CMMD_BUFFER_MAX;
+    UI_V4f color = v4f(0.5f, 0.5f, 0.5f, 1.0f);
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    UI_i64 begin = ui_time_now();
+    for (UI_u32 frame = 0; frame < frames; ++frame) {
+        list->count = 0;
+        for (UI_u32 i = 0; i < count; ++i) {
+            UI_DrawCmmd cmmd;
+            memset(&cmmd, 0, sizeof(UI_DrawCmmd));
+            cmmd.type = UI_DRAW_CMMD_RECT;
+            cmmd.pos = v2i((UI_i32)(i & 1023), (UI_i32)(i >> 10));
+            cmmd.dim = v2i(1, 1);
+            cmmd.color = color;
+            ui_push_draw_cmmd(cmmd);
+        }
+    }
+    UI_i64 copied = ui_time_now();
+    for (UI_u32 frame = 0; frame < frames; ++frame) {
+        list->count = 0;
+        for (UI_u32 i = 0; i < count; ++i) {
+            ui_push_rect(v2i((UI_i32)(i & 1023), (UI_i32)(i >> 10)), v2i(1, 1), color);
+        }
+    }
+    UI_i64 pushed = ui_time_now();
+    for (UI_u32 frame = 0; frame < frames; ++frame) {
+        list->count = 0;
+        UI_DrawCmmd *cmmds = ui_draw_reserve(count);
+        for (UI_u32 i = 0; i < count; ++i) {
+            ui_write_rect(cmmds + i, v2i((UI_i32)(i & 1023), (UI_i32)(i >> 10)), v2i(1, 1), color);
+        }
+    }
+    UI_i64 reserved = ui_time_now();
+    list->count = 0;
+    printf("draw benchmark: %u rects, copied %.3f ms, ui_push_rect %.3f ms, reserved span %.3f ms\n", count,
+           ui_time_seconds(copied - begin)*1000.0/frames, ui_time_seconds(pushed - copied)*1000.0/frames,
+           ui_time_seconds(reserved - pushed)*1000.0/frames);
+}
+#endif
+
+#if UI_IMAGE_BENCHMARK
+/* Every icon is requested in the first frame. Decoding happens on the workers and only a few
+   textures are created per frame, so frames keep their cost while the icons come in */
+void ui_image_benchmark(void) {
+    char path[MAX_PATH];
+    CreateDirectoryA("ui_image_benchmark", 0);
+    for (UI_u32 i = 0; i < UI_IMAGE_BENCHMARK; ++i) {
+        snprintf(path, MAX_PATH, "ui_image_benchmark/%u.ppm", i);
+        FILE *file = fopen(path, "wb");
+        if (!file) {
+            return;
+        }
+        fprintf(file, "P6 32 32 255\n");
+        for (UI_u32 j = 0; j < 32*32*3; ++j) {
+            fputc((int)((i*7 + j) & 0xff), file);
+        }
+        fclose(file);
+    }
+    UI_f64 first = 0.0;
+    UI_f64 worst = 0.0;
+    UI_f64 total = 0.0;
+    UI_u32 queued = 0;
+    UI_u32 frames = 0;
+    UI_u32 drawn = 0;
+    UI_i64 begin = ui_time_now();
+    while (drawn < UI_IMAGE_BENCHMARK && frames < 10000) {
+        ui_scheduler_wait();
+        ui_scheduler_begin_build();
+        ui_render_begin_frame();
+        UI_DrawList *list = ui_render.lists + ui_render.build_index;
+        UI_u64 start = list->count;
+        for (UI_u32 i = 0; i < UI_IMAGE_BENCHMARK; ++i) {
+            snprintf(path, MAX_PATH, "ui_image_benchmark/%u.ppm", i);
+            ui_image(path, 10 + (int)(i % 40)*19, 10 + (int)(i / 40)*19, 16, 16);
+        }
+        drawn = 0;
+        for (UI_u64 i = start; i < list->count; ++i) {
+            if (list->cmmds[i].type == UI_DRAW_CMMD_IMAGE) {
+                ++drawn;
+            }
+        }
+        /* Icons still waiting on a worker when the frame is done, the frame did not wait for them */
+        if (frames == 0) {
+            for (UI_u32 i = 0; i < UI_IMAGE_BENCHMARK; ++i) {
+                snprintf(path, MAX_PATH, "ui_image_benchmark/%u.ppm", i);
+                UI_ImageEntry *image = ui_image_request(path);
+                if (image && image->state == UI_IMAGE_QUEUED) {
+                    ++queued;
+                }
+            }
+        }
+        ui_update();
+        ui_scheduler_end_build();
+        UI_f64 cost = ui_time_seconds(ui_time_now() - ui_scheduler.build_begin)*1000.0;
+        ui_render_publish();
+        first = frames == 0 ? cost : first;
+        worst = cost > worst ? cost : worst;
+        total += cost;
+        ++frames;
+    }
+    printf("image benchmark: %u icons in %u frames, %.3f ms to all drawn, first frame %.3f ms with %u still decoding, "
+           "frame average %.3f ms, worst %.3f ms\n", UI_IMAGE_BENCHMARK, frames, ui_time_seconds(ui_time_now() - begin)*1000.0,
+           first, queued, total/frames, worst);
+}
+#endif
+
+#if UI_SCREEN_BENCHMARK
+/* Compile time for reference, what parsing at startup would cost, against mapping the blob
+   and building the first frame from it */
+void ui_screen_benchmark(void) {
+    char *source_path = "ui_screen_benchmark.ui";
+    char *blob_path = "ui_screen_benchmark.uib";
+    FILE *file = fopen(source_path, "wb");
+    if (!file) {
+        return;
+    }
+    fprintf(file, "style panel color 0.15 0.15 0.2 1 radius 6 padding 6 spacing 4\n");
+    for (UI_u32 i = 0; i < UI_SCREEN_BENCHMARK; ++i) {
+        fprintf(file, "container \"panel %u\" %u %u column panel {\n", i, (i % 10)*200, (i / 10)*300);
+        fprintf(file, "    label \"title\" \"Panel %u\"\n", i);
+        for (UI_u32 j = 0; j < 4; ++j) {
+            fprintf(file, "    container \"row %u\" row {\n", j);
+            fprintf(file, "        button \"button\" \"Apply\"\n        checkbox \"check\"\n        slider \"slider\"\n    }\n");
+        }
+        fprintf(file, "}\n");
+    }
+    fclose(file);
+    UI_i64 begin = ui_time_now();
+    ui_screen_compile(source_path, blob_path);
+    UI_i64 compiled = ui_time_now();
+    UI_Screen screen;
+    ui_screen_load(&screen, blob_path);
+    UI_i64 loaded = ui_time_now();
+    ui_render_begin_frame();
+    ui_screen_frame(&screen);
+    UI_i64 framed = ui_time_now();
+    UI_DrawList *list = ui_render.lists + ui_render.build_index;
+    printf("screen benchmark: %u nodes, compile %.3f ms, load %.3f ms, first frame %.3f ms (%llu commands)\n",
+           screen.node_count, ui_time_seconds(compiled - begin)*1000.0, ui_time_seconds(loaded - compiled)*1000.0,
+           ui_time_seconds(framed - loaded)*1000.0, list->count);
+    list->count = 0;
+    ui_screen_unload(&screen);
+}
+#endif
+
+#if UI_SNAPSHOT_BENCHMARK
+/* Windows of 1000 buttons, UI_SNAPSHOT_BENCHMARK widgets in all */
+void ui_snapshot_benchmark_build(void) {
+    for (UI_u32 i = 0; i < UI_SNAPSHOT_BENCHMARK; i += 1000) {
+        ui_push_id(ui_id_int(i));
+        ui_begin_window(UI_ID("snapshot benchmark"), 20, 20);
+        for (UI_u32 j = i; j < i + 1000 && j < UI_SNAPSHOT_BENCHMARK; ++j) {
+            ui_push_id(ui_id_int(j));
+            ui_button(UI_ID("button"), "button", 0, 0);
+            ui_pop_id();
+        }
+        ui_end_window();
+        ui_pop_id();
+    }
+}
+
+/* The widget pass of the first frame from an empty registry, where every window and widget is
+   allocated and inserted, against the same pass on the snapshot the first run wrote. The window
+   pass is left out, every button is a draw command and they do not fit in one draw list */
+void ui_snapshot_benchmark(void) {
+    char *path = "ui_snapshot_benchmark.bin";
+    /* The windows of the demo are set aside, both runs start without any */
+    UI_State *saved = (UI_State *)malloc(sizeof(UI_State));
+    *saved = ui_state;
+    ui_state.snapshot = 0;
+    ui_state.snapshot_size = 0;
+    ui_state.registry = 0;
+    ui_state.window_first = 0;
+    ui_state.window_order = 0;
+    ui_windows_free();
+    UI_i64 begin = ui_time_now();
+    ui_snapshot_benchmark_build();
+    UI_i64 built = ui_time_now();
+    UI_u64 size = 0;
+    UI_u8 *buffer = ui_snapshot_build(&size);
+    ui_snapshot_write(path, buffer, size);
+    free(buffer);
+    UI_i64 written = ui_time_now();
+    ui_windows_free();
+    UI_i64 load_begin = ui_time_now();
+    ui_snapshot_load(path);
+    UI_i64 loaded = ui_time_now();
+    ui_snapshot_benchmark_build();
+    UI_i64 rebuilt = ui_time_now();
+    UI_u64 registry_count = ui_state.registry_count;
+    ui_windows_free();
+    ui_snapshot_unmap();
+    /* Everything but the windows, the registry and the snapshot moved on, keep it */
+    saved->window_current = 0;
+    saved->id_stack_count = ui_state.id_stack_count;
+    memcpy(saved->frame_arenas, ui_state.frame_arenas, sizeof(ui_state.frame_arenas));
+    saved->frame_arena_index = ui_state.frame_arena_index;
+    ui_state = *saved;
+    free(saved);
+    printf("snapshot benchmark: %llu objects, %.1f KB, without %.3f ms, snapshot write %.3f ms, "
+           "with it load %.3f ms + build %.3f ms\n", registry_count, (UI_f64)size/1024.0,
+           ui_time_seconds(built - begin)*1000.0, ui_time_seconds(written - built)*1000.0,
+           ui_time_seconds(loaded - load_begin)*1000.0, ui_time_seconds(rebuilt - loaded)*1000.0);
+}
+#endif
+
+int main(int argc, char **argv) {
+    /* Offline step: ui_demo -compile screen.ui screen.uib */
+    if (argc == 4 && strcmp(argv[1], "-compile") == 0) {
+        return ui_screen_compile(argv[2], argv[3]) ? 0 : -1;
+    }
     HINSTANCE hinstance = GetModuleHandle(0);
 
     WNDCLASSA window_class = {0};
@@ -645,16 +5396,46 @@ int main(void) {
     }
 
     global_running = 1;
+    ui_init();
+    ui_render_init(window);
+#if UI_QUADS_BENCHMARK
+    ui_quads_benchmark();
+#endif
+#if UI_SCREEN_BENCHMARK
+    ui_screen_benchmark();
+#endif
+#if UI_WIDGET_ARRAY_BENCHMARK
+    ui_widget_array_benchmark();
+#endif
+#if UI_DRAW_BENCHMARK
+    ui_draw_benchmark();
+#endif
+#if UI_IMAGE_BENCHMARK
+    ui_image_benchmark();
+#endif
+#if UI_SNAPSHOT_BENCHMARK
+    ui_snapshot_benchmark();
+#endif
+    ui_demo_telemetry_start();
     while (global_running) {
+        /* Late latch: sleep first so the input drained below is as fresh as possible */
+        ui_scheduler_wait();
         MSG message;
         while (PeekMessage(&message, window, 0, 0, PM_REMOVE)) {
             TranslateMessage(&message);
             DispatchMessageA(&message);
         }
 
-        main_loop(window);
+        if (ui_scheduler_frame_needed()) {
+            main_loop(window);
+        } else {
+            ui_scheduler_skip_frame();
+        }
     }
 
+    ui_demo_telemetry_stop();
+    ui_render_quit();
+    ui_quit();
     wglDeleteContext(global_gl_context);
     return 0;
 }
@@ -11,38 +11,510 @@ static UI_u64 draw_cmmd_buffer_count;
 
 /* UI state globals */
 static UI_State ui;
+static UI_FrameScheduler ui_scheduler;
+static UI_LayoutPool ui_layout_pool;
 
-UI_RectMesh ui_rect_get_mesh(UI_V2i pos, UI_V2i dim) {
-    UI_RectMesh result;
-    /* Setup first triangle */
-    result.t[0].v[0] = pos;
-    result.t[0].v[1].x = pos.x;
-    result.t[0].v[1].y = pos.y + dim.y;
-    result.t[0].v[2].x = pos.x + dim.x;
-    result.t[0].v[2].y = pos.y;
-    /* Setup seconds triangle */
-    result.t[1].v[0].x = pos.x + dim.x;
-    result.t[1].v[0].y = pos.y;
-    result.t[1].v[1].x = pos.x;
-    result.t[1].v[1].y = pos.y + dim.y;
-    result.t[1].v[2] = v2i_add(pos, dim);
+/* Frame scheduler */
+inline UI_i64 ui_time_now(void) {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
 
-    return result;
+inline UI_f64 ui_time_seconds(UI_i64 ticks) {
+    return (UI_f64)ticks / (UI_f64)ui_scheduler.frequency;
+}
+
+void ui_scheduler_init(void) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    ui_scheduler.frequency = frequency.QuadPart;
+    ui_scheduler.frame_period = 1.0/60.0;
+    ui_scheduler.last_present = ui_time_now();
+    /* Make Sleep precise enough to wake up close to the deadline */
+    timeBeginPeriod(1);
+}
+
+void ui_scheduler_quit(void) {
+    timeEndPeriod(1);
+}
+
+inline void ui_scheduler_input_event(void) {
+    if (!ui_scheduler.pending_input) {
+        ui_scheduler.pending_input = ui_time_now();
+    }
+}
+
+/* Input sitting in the queue is stamped now. The wait runs this before and during its sleep,
+   stamping input only when it is dispatched after the sleep would hide the time it waited */
+inline void ui_scheduler_poll_input(void) {
+    if (HIWORD(GetQueueStatus(QS_INPUT))) {
+        ui_scheduler_input_event();
+    }
+}
+
+/* Wait until the latest point where the frame can still be built before the next present */
+void ui_scheduler_wait(void) {
+    UI_f64 margin = 0.001;
+    UI_f64 start = ui_scheduler.frame_period - ui_scheduler.build_cost*1.5 - margin;
+    UI_i64 deadline = ui_scheduler.last_present + (UI_i64)(start*(UI_f64)ui_scheduler.frequency);
+    UI_i64 now = ui_time_now();
+    ui_scheduler_poll_input();
+    while (now < deadline) {
+        UI_f64 remaining = ui_time_seconds(deadline - now);
+        if (remaining > 0.002) {
+            /* New input wakes the thread up to be stamped, then it sleeps on to the deadline */
+            MsgWaitForMultipleObjects(0, 0, FALSE, (DWORD)((remaining - 0.001)*1000.0), QS_INPUT);
+        } else {
+            YieldProcessor();
+        }
+        ui_scheduler_poll_input();
+        now = ui_time_now();
+    }
+}
+
+void ui_scheduler_begin_build(void) {
+    ui_scheduler.build_begin = ui_time_now();
+    ui_scheduler.frame_input = ui_scheduler.pending_input;
+    ui_scheduler.pending_input = 0;
+}
+
+void ui_scheduler_end_build(void) {
+    UI_f64 cost = ui_time_seconds(ui_time_now() - ui_scheduler.build_begin);
+    if (cost > ui_scheduler.build_cost) {
+        ui_scheduler.build_cost = cost;
+    } else {
+        ui_scheduler.build_cost = ui_scheduler.build_cost*0.95 + cost*0.05;
+    }
+}
+
+void ui_scheduler_present(void) {
+    UI_i64 now = ui_time_now();
+    UI_f64 period = ui_time_seconds(now - ui_scheduler.last_present);
+    /* Ignore hitches and repeated presents so one bad frame does not move the deadline */
+    if (period > 1.0/240.0 && period < 1.0/15.0) {
+        ui_scheduler.frame_period = ui_scheduler.frame_period*0.9 + period*0.1;
+    }
+    ui_scheduler.last_present = now;
+    if (ui_scheduler.frame_input) {
+        UI_u64 bucket = (UI_u64)(ui_time_seconds(now - ui_scheduler.frame_input)*1000.0);
+        if (bucket >= UI_LATENCY_BUCKET_COUNT) {
+            bucket = UI_LATENCY_BUCKET_COUNT - 1;
+        }
+        ++ui_scheduler.latency_histogram[bucket];
+        ++ui_scheduler.latency_count;
+        ui_scheduler.frame_input = 0;
+    }
+}
+
+void ui_scheduler_print_latency(void) {
+    printf("input to present latency (%llu frames with input)\n", ui_scheduler.latency_count);
+    for (UI_u32 i = 0; i < UI_LATENCY_BUCKET_COUNT; ++i) {
+        if (ui_scheduler.latency_histogram[i]) {
+            printf("  %2u ms%s: %llu\n", i, (i == UI_LATENCY_BUCKET_COUNT - 1) ? "+" : " ",
+                   ui_scheduler.latency_histogram[i]);
+        }
+    }
+}
+
+/* Vertex streams generated from the draw command buffer */
+static UI_V2i draw_vertex_buffer[UI_DRAW_CMMD_BUFFER_MAX*4];
+static UI_V4f draw_color_buffer[UI_DRAW_CMMD_BUFFER_MAX*4];
+static UI_u32 draw_index_buffer[UI_DRAW_CMMD_BUFFER_MAX*6];
+
+/* Index sequence for 8 consecutive quads (quad * 4 + {0, 1, 2, 2, 1, 3}) */
+static const UI_u32 ui_quad_index_pattern[48] = {
+     0,  1,  2,  2,  1,  3,   4,  5,  6,  6,  5,  7,
+     8,  9, 10, 10,  9, 11,  12, 13, 14, 14, 13, 15,
+    16, 17, 18, 18, 17, 19,  20, 21, 22, 22, 21, 23,
+    24, 25, 26, 26, 25, 27,  28, 29, 30, 30, 29, 31,
+};
+
+void ui_quads_expand_scalar(UI_DrawCmmd *cmmds, UI_u64 count, UI_u32 base_vertex,
+                            UI_V2i *vertices, UI_V4f *colors, UI_u32 *indices) {
+    for (UI_u64 i = 0; i < count; ++i) {
+        UI_DrawCmmd *cmmd = cmmds + i;
+        UI_V2i *v = vertices + i*4;
+        UI_V4f *c = colors + i*4;
+        UI_u32 *index = indices + i*6;
+        UI_u32 base = base_vertex + (UI_u32)(i*4);
+        /* Setup vertices */
+        v[0] = cmmd->pos;
+        v[1] = v2i(cmmd->pos.x, cmmd->pos.y + cmmd->dim.y);
+        v[2] = v2i(cmmd->pos.x + cmmd->dim.x, cmmd->pos.y);
+        v[3] = v2i_add(cmmd->pos, cmmd->dim);
+        c[0] = cmmd->color;
+        c[1] = cmmd->color;
+        c[2] = cmmd->color;
+        c[3] = cmmd->color;
+        /* Setup triangles */
+        for (UI_u32 j = 0; j < 6; ++j) {
+            index[j] = base + ui_quad_index_pattern[j];
+        }
+    }
+}
+
+void ui_quads_expand_sse2(UI_DrawCmmd *cmmds, UI_u64 count, UI_u32 base_vertex,
+                          UI_V2i *vertices, UI_V4f *colors, UI_u32 *indices) {
+    /* {x, y, w, h} masks for {v0, v1} and {v2, v3} */
+    __m128i mask_lo = _mm_set_epi32(-1, 0, 0, 0);
+    __m128i mask_hi = _mm_set_epi32(-1, -1, 0, -1);
+    UI_u64 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (UI_u64 j = i; j < i + 4; ++j) {
+            __m128i a = _mm_loadu_si128((__m128i *)&cmmds[j].pos);
+            __m128i pos = _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 1, 0));
+            __m128i dim = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 2, 3, 2));
+            __m128 color = _mm_loadu_ps(&cmmds[j].color.x);
+            _mm_storeu_si128((__m128i *)(vertices + j*4 + 0), _mm_add_epi32(pos, _mm_and_si128(dim, mask_lo)));
+            _mm_storeu_si128((__m128i *)(vertices + j*4 + 2), _mm_add_epi32(pos, _mm_and_si128(dim, mask_hi)));
+            _mm_storeu_ps(&colors[j*4 + 0].x, color);
+            _mm_storeu_ps(&colors[j*4 + 1].x, color);
+            _mm_storeu_ps(&colors[j*4 + 2].x, color);
+            _mm_storeu_ps(&colors[j*4 + 3].x, color);
+        }
+        __m128i base = _mm_set1_epi32((int)(base_vertex + (UI_u32)(i*4)));
+        for (UI_u32 j = 0; j < 24; j += 4) {
+            __m128i pattern = _mm_loadu_si128((__m128i *)(ui_quad_index_pattern + j));
+            _mm_storeu_si128((__m128i *)(indices + i*6 + j), _mm_add_epi32(base, pattern));
+        }
+    }
+    ui_quads_expand_scalar(cmmds + i, count - i, base_vertex + (UI_u32)(i*4),
+                           vertices + i*4, colors + i*4, indices + i*6);
+}
+
+void ui_quads_expand_avx2(UI_DrawCmmd *cmmds, UI_u64 count, UI_u32 base_vertex,
+                          UI_V2i *vertices, UI_V4f *colors, UI_u32 *indices) {
+    __m256i mask_lo = _mm256_set_epi32(-1, 0, 0, 0, -1, 0, 0, 0);
+    __m256i mask_hi = _mm256_set_epi32(-1, -1, 0, -1, -1, -1, 0, -1);
+    UI_u64 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        /* Two commands per register, one in each 128 bit lane */
+        for (UI_u64 j = i; j < i + 8; j += 2) {
+            __m256i r0 = _mm256_loadu_si256((__m256i *)(cmmds + j + 0));
+            __m256i r1 = _mm256_loadu_si256((__m256i *)(cmmds + j + 1));
+            __m256i a = _mm256_permute2x128_si256(r0, r1, 0x20);
+            __m256i color = _mm256_permute2x128_si256(r0, r1, 0x31);
+            __m256i pos = _mm256_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256i dim = _mm256_shuffle_epi32(a, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256i lo = _mm256_add_epi32(pos, _mm256_and_si256(dim, mask_lo));
+            __m256i hi = _mm256_add_epi32(pos, _mm256_and_si256(dim, mask_hi));
+            __m256i color0 = _mm256_permute2x128_si256(color, color, 0x00);
+            __m256i color1 = _mm256_permute2x128_si256(color, color, 0x11);
+            _mm256_storeu_si256((__m256i *)(vertices + j*4 + 0), _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i *)(vertices + j*4 + 4), _mm256_permute2x128_si256(lo, hi, 0x31));
+            _mm256_storeu_si256((__m256i *)(colors + j*4 + 0), color0);
+            _mm256_storeu_si256((__m256i *)(colors + j*4 + 2), color0);
+            _mm256_storeu_si256((__m256i *)(colors + j*4 + 4), color1);
+            _mm256_storeu_si256((__m256i *)(colors + j*4 + 6), color1);
+        }
+        __m256i base = _mm256_set1_epi32((int)(base_vertex + (UI_u32)(i*4)));
+        for (UI_u32 j = 0; j < 48; j += 8) {
+            __m256i pattern = _mm256_loadu_si256((__m256i *)(ui_quad_index_pattern + j));
+            _mm256_storeu_si256((__m256i *)(indices + i*6 + j), _mm256_add_epi32(base, pattern));
+        }
+    }
+    ui_quads_expand_sse2(cmmds + i, count - i, base_vertex + (UI_u32)(i*4),
+                         vertices + i*4, colors + i*4, indices + i*6);
+}
+
+void ui_quads_init(void) {
+    int info[4];
+    ui_quads_expand = ui_quads_expand_scalar;
+    __cpuid(info, 1);
+    UI_b32 has_sse2 = (info[3] & (1 << 26)) != 0;
+    UI_b32 has_avx = (info[2] & (1 << 28)) != 0;
+    UI_b32 has_osxsave = (info[2] & (1 << 27)) != 0;
+    if (has_sse2) {
+        ui_quads_expand = ui_quads_expand_sse2;
+    }
+    /* The os must save the ymm registers before we can use avx */
+    if (has_avx && has_osxsave && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) {
+            ui_quads_expand = ui_quads_expand_avx2;
+        }
+    }
+}
+
+#if UI_QUADS_BENCHMARK
+/* Every kernel the cpu runs against the scalar one, over each tail the 8 and 4 wide loops can
+   leave and an odd, unaligned full buffer. All outputs start from the same fill so a write
+   past the end is a mismatch too. Then the time of each kernel on the full buffer */
+void ui_quads_benchmark(void) {
+    enum { full = UI_DRAW_CMMD_BUFFER_MAX - 3, tails = 17, repeats = 2000 };
+    UI_QUADS_EXPAND_PROC kernels[] = { ui_quads_expand_scalar, ui_quads_expand_sse2, ui_quads_expand_avx2 };
+    char *names[] = { "scalar", "sse2", "avx2" };
+    /* ui_quads_init only picks a kernel the cpu and the os support */
+    UI_u32 kernel_count = 1;
+    if (ui_quads_expand == ui_quads_expand_sse2) kernel_count = 2;
+    if (ui_quads_expand == ui_quads_expand_avx2) kernel_count = 3;
+    UI_DrawCmmd *cmmds = (UI_DrawCmmd *)malloc(sizeof(UI_DrawCmmd)*UI_DRAW_CMMD_BUFFER_MAX);
+    memset(cmmds, 0, sizeof(UI_DrawCmmd)*UI_DRAW_CMMD_BUFFER_MAX);
+    UI_u32 seed = 1;
+    for (UI_u32 i = 0; i < UI_DRAW_CMMD_BUFFER_MAX; ++i) {
+        seed = seed*1103515245 + 12345;
+        cmmds[i].pos = v2i((UI_i32)((seed >> 8) % 2000) - 500, (UI_i32)((seed >> 4) % 1500) - 300);
+        cmmds[i].dim = v2i((UI_i32)((seed >> 12) % 300), (UI_i32)((seed >> 16) % 200));
+        cmmds[i].color = v4f((UI_f32)(seed & 255)/255.0f, (UI_f32)((seed >> 8) & 255)/255.0f,
+                             (UI_f32)((seed >> 16) & 255)/255.0f, (UI_f32)(seed >> 24)/255.0f);
+    }
+    UI_V2i *vertices[3];
+    UI_V4f *colors[3];
+    UI_u32 *indices[3];
+    for (UI_u32 k = 0; k < 3; ++k) {
+        vertices[k] = (UI_V2i *)malloc(sizeof(UI_V2i)*UI_DRAW_CMMD_BUFFER_MAX*4);
+        colors[k] = (UI_V4f *)malloc(sizeof(UI_V4f)*UI_DRAW_CMMD_BUFFER_MAX*4);
+        indices[k] = (UI_u32 *)malloc(sizeof(UI_u32)*UI_DRAW_CMMD_BUFFER_MAX*6);
+    }
+    UI_u32 mismatches[3] = { 0, 0, 0 };
+    for (UI_u32 c = 0; c <= tails + 1; ++c) {
+        UI_u64 count = (c <= tails) ? c : full;
+        UI_DrawCmmd *first = cmmds + (c & 1);
+        for (UI_u32 k = 0; k < kernel_count; ++k) {
+            memset(vertices[k], 0xcd, sizeof(UI_V2i)*UI_DRAW_CMMD_BUFFER_MAX*4);
+            memset(colors[k], 0xcd, sizeof(UI_V4f)*UI_DRAW_CMMD_BUFFER_MAX*4);
+            memset(indices[k], 0xcd, sizeof(UI_u32)*UI_DRAW_CMMD_BUFFER_MAX*6);
+            kernels[k](first, count, c*37, vertices[k], colors[k], indices[k]);
+            if (memcmp(vertices[k], vertices[0], sizeof(UI_V2i)*UI_DRAW_CMMD_BUFFER_MAX*4) != 0 ||
+                memcmp(colors[k], colors[0], sizeof(UI_V4f)*UI_DRAW_CMMD_BUFFER_MAX*4) != 0 ||
+                memcmp(indices[k], indices[0], sizeof(UI_u32)*UI_DRAW_CMMD_BUFFER_MAX*6) != 0) {
+                ++mismatches[k];
+            }
+        }
+    }
+    for (UI_u32 k = 0; k < kernel_count; ++k) {
+        UI_i64 begin = ui_time_now();
+        for (UI_u32 r = 0; r < repeats; ++r) {
+            kernels[k](cmmds + 1, full, 0, vertices[k], colors[k], indices[k]);
+        }
+        UI_f64 us = ui_time_seconds(ui_time_now() - begin)*1000000.0/repeats;
+        printf("quads %-6s: %u of %u counts differ from scalar, %.3f us for %u commands\n", names[k],
+               mismatches[k], tails + 2, us, (UI_u32)full);
+    }
+    for (UI_u32 k = kernel_count; k < 3; ++k) {
+        printf("quads %-6s: not supported by this cpu\n", names[k]);
+    }
+    for (UI_u32 k = 0; k < 3; ++k) {
+        free(vertices[k]);
+        free(colors[k]);
+        free(indices[k]);
+    }
+    free(cmmds);
+}
+#endif
+
+/* Span of count commands at the end of the draw buffer after a single capacity check, the
+   caller writes every command in place. Whatever is left unwritten goes back with ui_draw_trim */
+inline UI_DrawCmmd *ui_draw_reserve(UI_u64 count) {
+    ASSERT(draw_cmmd_buffer_count + count <= UI_DRAW_CMMD_BUFFER_MAX);
+    UI_DrawCmmd *cmmds = draw_cmmd_buffer + draw_cmmd_buffer_count;
+    draw_cmmd_buffer_count += count;
+    return cmmds;
+}
+
+/* Ends the draw buffer at end, a pointer inside of the last reserved span */
+inline void ui_draw_trim(UI_DrawCmmd *end) {
+    ASSERT(end >= draw_cmmd_buffer && end <= draw_cmmd_buffer + draw_cmmd_buffer_count);
+    draw_cmmd_buffer_count = (UI_u64)(end - draw_cmmd_buffer);
 }
 
 void ui_push_draw_cmmd(UI_DrawCmmd cmmd) {
-    ASSERT(draw_cmmd_buffer_count < UI_DRAW_CMMD_BUFFER_MAX);
-    draw_cmmd_buffer[draw_cmmd_buffer_count++] = cmmd;
+    *ui_draw_reserve(1) = cmmd;
+}
+
+/* Writers fill one reserved command, the ui_push_ functions reserve it for them */
+inline void ui_write_rect(UI_DrawCmmd *cmmd, UI_V2i pos, UI_V2i dim, UI_V4f color) {
+    memset(cmmd, 0, sizeof(UI_DrawCmmd));
+    cmmd->pos = pos;
+    cmmd->dim = dim;
+    cmmd->color = color;
 }
 
 void ui_push_rect(UI_V2i pos, UI_V2i dim, UI_V4f color) {
-    UI_DrawCmmd cmmd;
-    cmmd.pos = pos;
-    cmmd.dim = dim;
-    cmmd.color = color;
-    ui_push_draw_cmmd(cmmd);
+    ui_write_rect(ui_draw_reserve(1), pos, dim, color);
+}
+
+/* Arenas */
+
+void *ui_arena_push(UI_Arena *arena, UI_u64 size) {
+    size = (size + (UI_ARENA_ALIGN - 1)) & ~(UI_u64)(UI_ARENA_ALIGN - 1);
+    UI_ArenaBlock *block = arena->current;
+    /* Blocks after the current one are empty, they were kept from an earlier round */
+    while (block && block->used + size > block->size) {
+        block = block->next;
+    }
+    if (!block) {
+        UI_u64 block_size = size > UI_ARENA_BLOCK_SIZE ? size : UI_ARENA_BLOCK_SIZE;
+        block = (UI_ArenaBlock *)malloc(sizeof(UI_ArenaBlock) + block_size);
+        if (!block) {
+            printf("Error: Cannot allocate arena block of %llu bytes\n", block_size);
+            exit(-1);
+        }
+        block->next = 0;
+        block->size = block_size;
+        block->used = 0;
+        if (arena->last) {
+            arena->last->next = block;
+        } else {
+            arena->first = block;
+        }
+        arena->last = block;
+    }
+    arena->current = block;
+    void *result = (UI_u8 *)(block + 1) + block->used;
+    block->used += size;
+    arena->used += size;
+    return result;
+}
+
+void ui_arena_reset(UI_Arena *arena) {
+    for (UI_ArenaBlock *block = arena->first; block; block = block->next) {
+#if UI_ARENA_DEBUG
+        memset(block + 1, UI_ARENA_POISON, block->used);
+#endif
+        block->used = 0;
+    }
+    arena->high_water = arena->used > arena->high_water ? arena->used : arena->high_water;
+    arena->used = 0;
+    arena->current = arena->first;
+}
+
+void ui_arena_free(UI_Arena *arena) {
+    UI_ArenaBlock *block = arena->first;
+    while (block) {
+        UI_ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    memset(arena, 0, sizeof(UI_Arena));
+}
+
+inline UI_Arena *ui_frame_arena(void) {
+    return ui.frame_arenas + ui.frame_arena_index;
+}
+
+inline void *ui_frame_push(UI_u64 size) {
+    return ui_arena_push(ui_frame_arena(), size);
+}
+
+/* Ends the frame: the arena of the frame before the one just built is reset and becomes
+   the arena of the next frame */
+void ui_frame_arena_flip(void) {
+    UI_Arena *built = ui_frame_arena();
+    if (built->used > ui.frame_high_water) {
+        ui.frame_high_water = built->used;
+#if UI_ARENA_DEBUG
+        printf("frame %llu: new arena maximum %llu bytes\n", ui.frame, built->used);
+#endif
+    }
+    ui.frame_arena_index ^= 1;
+    ui_arena_reset(ui_frame_arena());
+    ui.layout_nodes = 0;
+    ui.layout_count = 0;
+    ui.widget_count = 0;
+    ++ui.frame;
+}
+
+/* Widget ids */
+UI_u64 ui_hash_string(char *string) {
+    /* FNV-1a */
+    UI_u64 hash = 14695981039346656037ull;
+    while (*string) {
+        hash ^= (UI_u8)*string++;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline UI_u64 ui_hash_u64(UI_u64 x) {
+    /* splitmix64 finalizer */
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+inline UI_Id ui_id_string(char *string) {
+    return ui_hash_string(string);
+}
+
+inline UI_Id ui_id_int(UI_i64 value) {
+    return ui_hash_u64((UI_u64)value);
+}
+
+inline UI_Id ui_id_ptr(void *ptr) {
+    return ui_hash_u64((UI_u64)(uintptr_t)ptr);
+}
+
+/* Mix a key with the seed on top of the id stack, 0 is reserved for "no widget" */
+UI_Id ui_id_resolve(UI_Id key) {
+    UI_Id seed = ui.id_stack_count ? ui.id_stack[ui.id_stack_count - 1] : 0;
+    UI_Id id = ui_hash_u64(seed ^ (key + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2)));
+    return id ? id : 1;
+}
+
+void ui_push_id(UI_Id key) {
+    ASSERT(ui.id_stack_count < UI_ID_STACK_MAX);
+    UI_Id id = ui_id_resolve(key);
+    ui.id_stack[ui.id_stack_count++] = id;
+}
+
+void ui_pop_id(void) {
+    ASSERT(ui.id_stack_count > 0);
+    --ui.id_stack_count;
 }
 
+/* Open addressing table from resolved ids to widgets. The ids are
+   already well mixed hashes so they index the table directly */
+void *ui_registry_get(UI_Id id) {
+    if (!ui.registry) {
+        return 0;
+    }
+    UI_u64 mask = ui.registry_capacity - 1;
+    for (UI_u64 i = id & mask;; i = (i + 1) & mask) {
+        UI_RegistrySlot *slot = ui.registry + i;
+        if (slot->id == id) {
+            return slot->value;
+        }
+        if (slot->id == 0) {
+            return 0;
+        }
+    }
+}
+
+void ui_registry_put(UI_Id id, void *value) {
+    if ((ui.registry_count + 1)*10 > ui.registry_capacity*7) {
+        UI_RegistrySlot *old_registry = ui.registry;
+        UI_u64 old_capacity = ui.registry_capacity;
+        ui.registry_capacity = old_capacity ? old_capacity*2 : 256;
+        ui.registry = (UI_RegistrySlot *)malloc(sizeof(UI_RegistrySlot)*ui.registry_capacity);
+        memset(ui.registry, 0, sizeof(UI_RegistrySlot)*ui.registry_capacity);
+        ui.registry_count = 0;
+        for (UI_u64 i = 0; i < old_capacity; ++i) {
+            if (old_registry[i].id) {
+                ui_registry_put(old_registry[i].id, old_registry[i].value);
+            }
+        }
+        free(old_registry);
+    }
+    UI_u64 mask = ui.registry_capacity - 1;
+    for (UI_u64 i = id & mask;; i = (i + 1) & mask) {
+        UI_RegistrySlot *slot = ui.registry + i;
+        if (slot->id == id || slot->id == 0) {
+            if (slot->id == 0) {
+                ++ui.registry_count;
+            }
+            slot->id = id;
+            slot->value = value;
+            return;
+        }
+    }
+}
+
+/* The links are frame data like the rest of the tree, every build links the widgets again */
 inline void ui_clear_tree_nodes(UI_Widget *widget) {
     widget->parent = 0;
     widget->first  = 0;
@@ -51,45 +523,173 @@ inline void ui_clear_tree_nodes(UI_Widget *widget) {
     widget->prev   = 0;
 }
 
-UI_Widget *ui_get_widget(void *id) {
-    UI_Widget *widget = ui.reglist;
-    while (widget) {
-        if (widget->id == id) {
-            ui_clear_tree_nodes(widget);
-            return widget;
-        }
-        widget = widget->reglist_next;
+UI_Widget *ui_get_widget(UI_Id id) {
+    UI_Widget *widget = (UI_Widget *)ui_registry_get(id);
+    if (widget) {
+        ui_clear_tree_nodes(widget);
+        return widget;
     }
     widget = (UI_Widget *)malloc(sizeof(UI_Widget));
     memset(widget, 0, sizeof(UI_Widget));
     widget->id = id;
-    widget->reglist_next = ui.reglist;
-    ui.reglist = widget;
+    ui_registry_put(id, widget);
     printf("malloc widget %llx\n", (UI_u64)widget);
     return widget;
 }
 
-void ui_init(void) {
+void ui_grid_reserve(UI_GridLayout *grid, UI_u32 cell_count, UI_u32 row_count) {
+    if (cell_count > grid->cell_capacity) {
+        grid->cell_capacity = grid->cell_capacity ? grid->cell_capacity : 256;
+        while (grid->cell_capacity < cell_count) {
+            grid->cell_capacity *= 2;
+        }
+        grid->cells = (UI_GridCell *)realloc(grid->cells, sizeof(UI_GridCell)*grid->cell_capacity);
+    }
+    if (!grid->column_content) {
+        grid->column_content = (UI_i32 *)calloc(UI_GRID_TRACK_MAX, sizeof(UI_i32));
+        grid->column_offset = (UI_i32 *)calloc(UI_GRID_TRACK_MAX + 1, sizeof(UI_i32));
+        grid->column_dirty = (UI_u8 *)calloc(UI_GRID_TRACK_MAX, 1);
+    }
+    /* Row offsets are written even with no rows at all */
+    if (row_count > grid->track_row_capacity || !grid->row_offset) {
+        UI_u32 old = grid->row_offset ? grid->track_row_capacity + 1 : 0;
+        grid->track_row_capacity = grid->track_row_capacity ? grid->track_row_capacity : 64;
+        while (grid->track_row_capacity < row_count) {
+            grid->track_row_capacity *= 2;
+        }
+        UI_u32 grown = grid->track_row_capacity + 1 - old;
+        grid->row_content = (UI_i32 *)realloc(grid->row_content, sizeof(UI_i32)*(grid->track_row_capacity + 1));
+        grid->row_offset = (UI_i32 *)realloc(grid->row_offset, sizeof(UI_i32)*(grid->track_row_capacity + 1));
+        grid->row_dirty = (UI_u8 *)realloc(grid->row_dirty, grid->track_row_capacity + 1);
+        memset(grid->row_content + old, 0, sizeof(UI_i32)*grown);
+        memset(grid->row_offset + old, 0, sizeof(UI_i32)*grown);
+        memset(grid->row_dirty + old, 0, grown);
+    }
 }
 
-void ui_quit(void) {
-    UI_Widget *widget = ui.reglist;
-    while(widget) {
-        UI_Widget *to_free = widget;
-        widget = widget->reglist_next;
-        printf("  free widget %llx\n", (UI_u64)to_free);
-        free(to_free); /* TODO: Why after call free on widget the programs jumps to undefine behavior */
+void ui_grid_free(UI_GridLayout *grid) {
+    free(grid->cells);
+    free(grid->column_content);
+    free(grid->column_offset);
+    free(grid->column_dirty);
+    free(grid->row_content);
+    free(grid->row_offset);
+    free(grid->row_dirty);
+    free(grid);
+}
+
+/* Turns the track sizes into offsets, returns TRUE if any of them moved */
+UI_b32 ui_grid_resolve(UI_Track *tracks, UI_u32 declared, UI_u32 count, UI_i32 *content,
+                       UI_i32 available, UI_i32 *offset) {
+    UI_i32 used = 0;
+    UI_f32 weight = 0.0f;
+    for (UI_u32 i = 0; i < count; ++i) {
+        UI_Track track = (i < declared) ? tracks[i] : (UI_Track){UI_TRACK_AUTO, 0.0f};
+        switch (track.sizing) {
+            case UI_TRACK_FIXED: { used += (UI_i32)track.value; } break;
+            case UI_TRACK_AUTO: { used += content[i]; } break;
+            case UI_TRACK_FRACTION: {
+                if (available > 0) {
+                    weight += track.value;
+                } else {
+                    used += content[i];
+                }
+            } break;
+        }
+    }
+    UI_i32 left = ui_i32_max(available - used, 0);
+    UI_b32 changed = FALSE;
+    UI_i32 at = 0;
+    for (UI_u32 i = 0; i < count; ++i) {
+        UI_Track track = (i < declared) ? tracks[i] : (UI_Track){UI_TRACK_AUTO, 0.0f};
+        UI_i32 size = content[i];
+        if (track.sizing == UI_TRACK_FIXED) {
+            size = (UI_i32)track.value;
+        } else if (track.sizing == UI_TRACK_FRACTION && available > 0 && weight > 0.0f) {
+            size = (UI_i32)((UI_f32)left*track.value/weight);
+        }
+        changed |= (offset[i] != at);
+        offset[i] = at;
+        at += size;
     }
-    ui.reglist = 0;
+    changed |= (offset[count] != at);
+    offset[count] = at;
+    return changed;
 }
 
-void ui_update_layout(UI_Widget *widget) {
-    UI_Widget *child = widget->first;
+/* First pass of the grid: pick up the cells that changed, re-measure only their rows and
+   columns and resolve the track sizes */
+void ui_measure_grid(UI_Widget *widget) {
+    UI_GridLayout *grid = widget->grid;
+    UI_u32 columns = grid->column_count;
+    UI_u32 count = 0;
+    for (UI_Widget *child = widget->first; child; child = child->next) {
+        ++count;
+    }
+    UI_u32 rows = (count + columns - 1) / columns;
+    rows = rows > grid->row_count ? rows : grid->row_count;
+    ui_grid_reserve(grid, count, rows);
+    if (grid->needs_measure || count != grid->cell_count || rows != grid->track_row_count) {
+        /* New tracks or cells moved to other tracks, start over */
+        grid->needs_measure = FALSE;
+        grid->cell_count = count;
+        grid->track_row_count = rows;
+        memset(grid->cells, 0, sizeof(UI_GridCell)*count);
+        memset(grid->column_dirty, 1, columns);
+        memset(grid->row_dirty, 1, rows);
+        memset(grid->column_content, 0, sizeof(UI_i32)*columns);
+        memset(grid->row_content, 0, sizeof(UI_i32)*rows);
+        grid->needs_place = TRUE;
+    }
+    UI_u32 i = 0;
+    for (UI_Widget *child = widget->first; child; child = child->next, ++i) {
+        UI_GridCell *cell = grid->cells + i;
+        if (cell->id != child->id || cell->dim.x != child->dim.x || cell->dim.y != child->dim.y) {
+            cell->id = child->id;
+            cell->dim = child->dim;
+            grid->column_dirty[i % columns] = TRUE;
+            grid->row_dirty[i / columns] = TRUE;
+            grid->needs_place = TRUE;
+        }
+    }
+    for (UI_u32 column = 0; column < columns; ++column) {
+        if (grid->column_dirty[column]) {
+            UI_i32 content = 0;
+            for (UI_u32 cell = column; cell < count; cell += columns) {
+                content = ui_i32_max(content, grid->cells[cell].dim.x);
+            }
+            grid->column_content[column] = content;
+            grid->column_dirty[column] = FALSE;
+        }
+    }
+    for (UI_u32 row = 0; row < rows; ++row) {
+        if (grid->row_dirty[row]) {
+            UI_i32 content = 0;
+            UI_u32 end = (row + 1)*columns < count ? (row + 1)*columns : count;
+            for (UI_u32 cell = row*columns; cell < end; ++cell) {
+                content = ui_i32_max(content, grid->cells[cell].dim.y);
+            }
+            grid->row_content[row] = content;
+            grid->row_dirty[row] = FALSE;
+        }
+    }
+    grid->needs_place |= ui_grid_resolve(grid->columns, grid->column_count, columns, grid->column_content,
+                                         grid->available.x, grid->column_offset);
+    grid->needs_place |= ui_grid_resolve(grid->rows, grid->row_count, rows, grid->row_content,
+                                         grid->available.y, grid->row_offset);
+    widget->dim.x = grid->available.x > 0 ? grid->available.x : grid->column_offset[columns];
+    widget->dim.y = grid->available.y > 0 ? grid->available.y : grid->row_offset[rows];
+}
+
+void ui_measure_widget(UI_Widget *widget) {
+    if (widget->layout == WIDGET_LAYOUT_GRID && widget->grid) {
+        ui_measure_grid(widget);
+        return;
+    }
     UI_V2i widget_dim = (widget->layout == WIDGET_LAYOUT_NONE) ? widget->dim : v2i(0, 0);
-    while (child) {
-        ui_update_layout(child);
-        child = child->next;
+    for (UI_Widget *child = widget->first; child; child = child->next) {
         switch (widget->layout) {
+            case WIDGET_LAYOUT_NONE: { } break;
             case WIDGET_LAYOUT_COLUMN: {
                 widget_dim.x = ui_i32_max(widget_dim.x, child->dim.x);
                 widget_dim.y += child->dim.y;
@@ -98,12 +698,246 @@ void ui_update_layout(UI_Widget *widget) {
                 widget_dim.x += child->dim.x;
                 widget_dim.y = ui_i32_max(widget_dim.y, child->dim.y);
             } break;
-            case WIDGET_LAYOUT_GRID: { /* TODO: Layout grid logic */ } break;
+            case WIDGET_LAYOUT_GRID: { /* measured by ui_measure_grid */ } break;
         }
     }
     widget->dim = widget_dim;
 }
 
+/* Second pass, the parent places its children once every size is known */
+void ui_place_widget(UI_Widget *widget) {
+    UI_V2i at = v2i(0, 0);
+    switch (widget->layout) {
+        case WIDGET_LAYOUT_NONE: { } break;
+        case WIDGET_LAYOUT_COLUMN: {
+            for (UI_Widget *child = widget->first; child; child = child->next) {
+                child->pos = at;
+                at.y += child->dim.y;
+            }
+        } break;
+        case WIDGET_LAYOUT_ROW: {
+            for (UI_Widget *child = widget->first; child; child = child->next) {
+                child->pos = at;
+                at.x += child->dim.x;
+            }
+        } break;
+        case WIDGET_LAYOUT_GRID: {
+            UI_GridLayout *grid = widget->grid;
+            if (!grid || !grid->needs_place) {
+                break;
+            }
+            UI_u32 i = 0;
+            for (UI_Widget *child = widget->first; child; child = child->next, ++i) {
+                child->pos = v2i(grid->column_offset[i % grid->column_count], grid->row_offset[i / grid->column_count]);
+            }
+            grid->needs_place = FALSE;
+        } break;
+    }
+}
+
+/* In pre-order every parent is placed before its children */
+void ui_place_range(UI_u32 begin, UI_u32 end) {
+    for (UI_u32 i = begin; i < end; ++i) {
+        ui_place_widget(ui.layout_nodes[i]);
+    }
+}
+
+/* In reverse pre-order every child is measured before its parent */
+void ui_measure_range(UI_u32 begin, UI_u32 end) {
+    for (UI_u32 i = end; i > begin; --i) {
+        ui_measure_widget(ui.layout_nodes[i - 1]);
+    }
+}
+
+void ui_flatten_tree(UI_Widget *root) {
+    /* Every widget of the tree went through ui_add_widget_to_tree this frame */
+    ui.layout_nodes = (UI_Widget **)ui_frame_push(sizeof(UI_Widget *)*ui.widget_count);
+    ui.layout_count = 0;
+    UI_Widget *widget = root;
+    while (widget) {
+        ASSERT(ui.layout_count < ui.widget_count);
+        widget->layout_index = ui.layout_count;
+        ui.layout_nodes[ui.layout_count++] = widget;
+        if (widget->first) {
+            widget = widget->first;
+            continue;
+        }
+        /* Close every subtree that ends with this leaf */
+        for (;;) {
+            widget->layout_size = ui.layout_count - widget->layout_index;
+            if (widget == root) {
+                widget = 0;
+                break;
+            }
+            if (widget->next) {
+                widget = widget->next;
+                break;
+            }
+            widget = widget->parent;
+        }
+    }
+}
+
+void ui_layout_run_tasks(UI_u32 self) {
+    UI_u32 queue_count = ui_layout_pool.worker_count + 1;
+    for (UI_u32 i = 0; i < queue_count; ++i) {
+        /* Own queue first, then steal */
+        UI_LayoutQueue *queue = ui_layout_pool.queues + ((self + i) % queue_count);
+        for (;;) {
+            LONG task = InterlockedIncrement(&queue->next) - 1;
+            if (task >= queue->end) {
+                break;
+            }
+            ui_measure_range(ui_layout_pool.tasks[task].begin, ui_layout_pool.tasks[task].end);
+            InterlockedDecrement(&ui_layout_pool.pending);
+        }
+    }
+}
+
+DWORD WINAPI ui_layout_worker_proc(LPVOID param) {
+    UI_u32 self = (UI_u32)(uintptr_t)param;
+    for (;;) {
+        WaitForSingleObject(ui_layout_pool.semaphore, INFINITE);
+        if (!ui_layout_pool.running) {
+            break;
+        }
+        ui_layout_run_tasks(self);
+        InterlockedIncrement(&ui_layout_pool.done);
+    }
+    return 0;
+}
+
+void ui_layout_pool_init(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    UI_u32 count = info.dwNumberOfProcessors > 1 ? (UI_u32)info.dwNumberOfProcessors - 1 : 0;
+    ui_layout_pool.worker_count = count < UI_LAYOUT_WORKER_MAX ? count : UI_LAYOUT_WORKER_MAX;
+    ui_layout_pool.semaphore = CreateSemaphoreA(0, 0, UI_LAYOUT_WORKER_MAX, 0);
+    ui_layout_pool.running = TRUE;
+    for (UI_u32 i = 0; i < ui_layout_pool.worker_count; ++i) {
+        ui_layout_pool.threads[i] = CreateThread(0, 0, ui_layout_worker_proc, (LPVOID)(uintptr_t)i, 0, 0);
+    }
+}
+
+void ui_layout_pool_quit(void) {
+    ui_layout_pool.running = FALSE;
+    ReleaseSemaphore(ui_layout_pool.semaphore, (LONG)ui_layout_pool.worker_count, 0);
+    for (UI_u32 i = 0; i < ui_layout_pool.worker_count; ++i) {
+        WaitForSingleObject(ui_layout_pool.threads[i], INFINITE);
+        CloseHandle(ui_layout_pool.threads[i]);
+    }
+    CloseHandle(ui_layout_pool.semaphore);
+}
+
+void ui_layout_push_task(UI_u32 begin, UI_u32 end) {
+    /* Neighbour subtrees are packed into one task, a grid with thousands of leaf cells
+       would otherwise make one task per cell */
+    if (ui_layout_pool.task_count) {
+        UI_LayoutTask *last = ui_layout_pool.tasks + ui_layout_pool.task_count - 1;
+        if (last->end == begin && end - last->begin <= UI_LAYOUT_TASK_GRAIN) {
+            last->end = end;
+            return;
+        }
+    }
+    UI_LayoutTask *task = ui_layout_pool.tasks + ui_layout_pool.task_count++;
+    task->begin = begin;
+    task->end = end;
+}
+
+void ui_measure_parallel(void) {
+    /* Subtrees that fit in a task are measured in parallel, the widgets above them
+       (the spine) are measured after on this thread. There is never more than a task per widget */
+    ui_layout_pool.tasks = (UI_LayoutTask *)ui_frame_push(sizeof(UI_LayoutTask)*ui.layout_count);
+    ui_layout_pool.task_count = 0;
+    for (UI_u32 i = 0; i < ui.layout_count;) {
+        UI_u32 size = ui.layout_nodes[i]->layout_size;
+        if (size <= UI_LAYOUT_TASK_GRAIN) {
+            ui_layout_push_task(i, i + size);
+            i += size;
+        } else {
+            i += 1;
+        }
+    }
+
+    UI_u32 queue_count = ui_layout_pool.worker_count + 1;
+    ui_layout_pool.pending = (LONG)ui_layout_pool.task_count;
+    ui_layout_pool.done = 0;
+    for (UI_u32 i = 0; i < queue_count; ++i) {
+        ui_layout_pool.queues[i].next = (LONG)((UI_u64)ui_layout_pool.task_count*i/queue_count);
+        ui_layout_pool.queues[i].end = (LONG)((UI_u64)ui_layout_pool.task_count*(i + 1)/queue_count);
+    }
+    MemoryBarrier();
+    ReleaseSemaphore(ui_layout_pool.semaphore, (LONG)ui_layout_pool.worker_count, 0);
+    ui_layout_run_tasks(ui_layout_pool.worker_count);
+    /* Wait for every worker woken by this dispatch so none of them touches the queues later */
+    while (ui_layout_pool.pending > 0 || ui_layout_pool.done < (LONG)ui_layout_pool.worker_count) {
+        YieldProcessor();
+    }
+
+    for (UI_u32 i = ui.layout_count; i > 0; --i) {
+        UI_Widget *widget = ui.layout_nodes[i - 1];
+        if (widget->layout_size > UI_LAYOUT_TASK_GRAIN) {
+            ui_measure_widget(widget);
+        }
+    }
+}
+
+void ui_update_layout(UI_Widget *root) {
+    if (!root) {
+        return;
+    }
+    ui_flatten_tree(root);
+    if (ui.layout_count < UI_LAYOUT_PARALLEL_MIN || ui_layout_pool.worker_count == 0) {
+        ui_measure_range(0, ui.layout_count);
+    } else {
+        ui_measure_parallel();
+    }
+    ui_place_range(0, ui.layout_count);
+}
+
+void ui_grid_benchmark(void);
+void ui_layout_benchmark(void);
+
+void ui_init(void) {
+    ui_quads_init();
+    ui_layout_pool_init();
+    ui_scheduler_init();
+#if UI_QUADS_BENCHMARK
+    ui_quads_benchmark();
+#endif
+#if UI_GRID_BENCHMARK
+    ui_grid_benchmark();
+#endif
+#if UI_LAYOUT_BENCHMARK
+    ui_layout_benchmark();
+#endif
+}
+
+void ui_quit(void) {
+    for (UI_u64 i = 0; i < ui.registry_capacity; ++i) {
+        UI_Widget *to_free = (UI_Widget *)ui.registry[i].value;
+        if (to_free) {
+            printf("  free widget %llx\n", (UI_u64)to_free);
+            if (to_free->grid) {
+                ui_grid_free(to_free->grid);
+            }
+            free(to_free);
+        }
+    }
+    free(ui.registry);
+    ui.registry = 0;
+    ui.registry_capacity = 0;
+    ui.registry_count = 0;
+    ui_layout_pool_quit();
+    printf("frame arena high water: %llu bytes\n", ui.frame_high_water);
+    ui_arena_free(ui.frame_arenas + 0);
+    ui_arena_free(ui.frame_arenas + 1);
+    ui.layout_nodes = 0;
+    ui.layout_count = 0;
+    ui_scheduler_quit();
+    ui_scheduler_print_latency();
+}
+
 void ui_render_layout(UI_Widget *widget) {
     /* TODO: Funtion not implemented */
     (void)widget;
@@ -115,6 +949,7 @@ void ui_update_and_render(void) {
 
     ui.root = 0;
     ui.current = 0;
+    ui_frame_arena_flip();
 }
 
 UI_Ctrl ui_do_ctrl(UI_Widget *widget, UI_Flags flags) {
@@ -133,6 +968,7 @@ UI_Ctrl ui_do_ctrl(UI_Widget *widget, UI_Flags flags) {
 }
 
 void ui_add_widget_to_tree(UI_Widget *widget) {
+    ++ui.widget_count;
     UI_Widget *parent = ui.current;
     if(parent) {
         if (!parent->first) {
@@ -148,8 +984,10 @@ void ui_add_widget_to_tree(UI_Widget *widget) {
     }
 }
 
-UI_Widget *ui_begin_widget(void *id) {
-    UI_Widget *widget = ui_get_widget(id);
+UI_Widget *ui_begin_widget(UI_Id key) {
+    /* The widget id seeds the ids of its children */
+    ui_push_id(key);
+    UI_Widget *widget = ui_get_widget(ui.id_stack[ui.id_stack_count - 1]);
     ui_add_widget_to_tree(widget);
     ui.current = widget;
     return widget;
@@ -157,10 +995,11 @@ UI_Widget *ui_begin_widget(void *id) {
 
 void ui_end_widget(void) {
     ui.current = ui.current->parent;
+    ui_pop_id();
 }
 
-void ui_container_begin(void *id) {
-    UI_Widget *widget = ui_begin_widget(id);
+void ui_container_begin(UI_Id key) {
+    UI_Widget *widget = ui_begin_widget(key);
     UI_Ctrl result = ui_do_ctrl(widget, UI_CONTAINER|UI_CLICKABLE|UI_CLIPPING);
     (void)result;
 }
@@ -169,18 +1008,150 @@ void ui_container_end(void) {
     ui_end_widget();
 }
 
-void main_loop(float dt) {
-    ui_push_rect(v2i(100, 100), v2i(100, 100), v4f(0.6f, 0.2f, 0.8f, 1.0f));
+/* Children of the grid fill its cells in row-major order */
+void ui_grid_begin(UI_Id key, UI_Track *columns, UI_u32 column_count, UI_Track *rows, UI_u32 row_count, UI_V2i available) {
+    ASSERT(column_count > 0 && column_count <= UI_GRID_TRACK_MAX && row_count <= UI_GRID_TRACK_MAX);
+    UI_Widget *widget = ui_begin_widget(key);
+    widget->layout = WIDGET_LAYOUT_GRID;
+    if (!widget->grid) {
+        widget->grid = (UI_GridLayout *)malloc(sizeof(UI_GridLayout));
+        memset(widget->grid, 0, sizeof(UI_GridLayout));
+    }
+    UI_GridLayout *grid = widget->grid;
+    if (grid->column_count != column_count || grid->row_count != row_count ||
+        memcmp(grid->columns, columns, sizeof(UI_Track)*column_count) != 0 ||
+        memcmp(grid->rows, rows, sizeof(UI_Track)*row_count) != 0 ||
+        grid->available.x != available.x || grid->available.y != available.y) {
+        /* New tracks, every cell is measured again */
+        memcpy(grid->columns, columns, sizeof(UI_Track)*column_count);
+        memcpy(grid->rows, rows, sizeof(UI_Track)*row_count);
+        grid->column_count = column_count;
+        grid->row_count = row_count;
+        grid->available = available;
+        grid->needs_measure = TRUE;
+    }
+}
 
-    static char *ids = "0123456789";
-    ui_begin_widget((void *)(ids + 0));
+void ui_grid_end(void) {
+    ui_end_widget();
+}
 
-    ui_begin_widget((void *)(ids + 1));
+/* Leaf widget with a fixed size */
+void ui_box(UI_Id key, UI_V2i dim) {
+    UI_Widget *widget = ui_begin_widget(key);
+    widget->layout = WIDGET_LAYOUT_NONE;
+    widget->dim = dim;
     ui_end_widget();
+}
+
+#if UI_GRID_BENCHMARK
+/* Layout time of a grid with a cold cache, with nothing changed and with one cell changed */
+UI_i64 ui_grid_benchmark_build(UI_u32 cell_count, UI_u32 changed) {
+    UI_Track columns[] = { {UI_TRACK_FIXED, 48.0f}, {UI_TRACK_AUTO, 0.0f}, {UI_TRACK_FRACTION, 1.0f},
+                           {UI_TRACK_AUTO, 0.0f}, {UI_TRACK_FRACTION, 2.0f}, {UI_TRACK_AUTO, 0.0f},
+                           {UI_TRACK_AUTO, 0.0f}, {UI_TRACK_FIXED, 64.0f} };
+    ui_grid_begin(UI_ID("benchmark grid"), columns, ARRAY_COUNT(columns), 0, 0, v2i(1920, 0));
+    for (UI_u32 i = 0; i < cell_count; ++i) {
+        ui_box(ui_id_int(i), v2i(16 + (i*7) % 64 + (i == changed ? 100 : 0), 12 + (i*5) % 20));
+    }
+    ui_grid_end();
+    UI_i64 begin = ui_time_now();
+    ui_update_layout(ui.root);
+    UI_i64 ticks = ui_time_now() - begin;
+    ui.root = 0;
+    ui.current = 0;
+    ui_frame_arena_flip();
+    return ticks;
+}
+
+void ui_grid_benchmark(void) {
+    UI_u32 cell_counts[] = { 1000, 10000, 100000 };
+    for (UI_u32 i = 0; i < ARRAY_COUNT(cell_counts); ++i) {
+        UI_u32 cell_count = cell_counts[i];
+        UI_i64 cold = ui_grid_benchmark_build(cell_count, (UI_u32)-1);
+        UI_i64 steady = ui_grid_benchmark_build(cell_count, (UI_u32)-1);
+        UI_i64 one_changed = ui_grid_benchmark_build(cell_count, cell_count / 2);
+        printf("grid %6u cells: cold %.3f ms, steady %.3f ms, one changed %.3f ms\n", cell_count,
+               ui_time_seconds(cold)*1000.0, ui_time_seconds(steady)*1000.0, ui_time_seconds(one_changed)*1000.0);
+    }
+}
+#endif
 
-    ui_begin_widget((void *)(ids + 2));
+#if UI_LAYOUT_BENCHMARK
+/* Every level holds a few leaves, in the chain the rest of the tree hangs below the last leaf */
+void ui_layout_benchmark_build(UI_b32 deep) {
+    UI_Widget *root = ui_begin_widget(UI_ID("benchmark layout"));
+    root->layout = WIDGET_LAYOUT_COLUMN;
+    for (UI_u32 i = 0; i < 1000; ++i) {
+        /* A level of the chain shares its parent with leaves keyed by index */
+        UI_Widget *widget = ui_begin_widget(deep ? UI_ID("level") : ui_id_int(i));
+        widget->layout = (i & 1) ? WIDGET_LAYOUT_ROW : WIDGET_LAYOUT_COLUMN;
+        for (UI_u32 j = 0; j < 4; ++j) {
+            ui_box(ui_id_int(j), v2i(8 + (UI_i32)((i + j) % 7), 6 + (UI_i32)((i*j) % 5)));
+        }
+        if (!deep) {
+            ui_end_widget();
+        }
+    }
+    if (deep) {
+        for (UI_u32 i = 0; i < 1000; ++i) {
+            ui_end_widget();
+        }
+    }
     ui_end_widget();
+}
 
+/* Measuring every widget on this thread against ui_update_layout, which hands the subtrees
+   that fit in a task to the work stealing pool */
+UI_i64 ui_layout_benchmark_run(UI_b32 deep, UI_b32 pool, UI_u32 *widgets, UI_u32 *tasks) {
+    ui_layout_benchmark_build(deep);
+    ui_layout_pool.task_count = 0;
+    UI_i64 begin = ui_time_now();
+    if (pool) {
+        ui_update_layout(ui.root);
+    } else {
+        ui_flatten_tree(ui.root);
+        ui_measure_range(0, ui.layout_count);
+        ui_place_range(0, ui.layout_count);
+    }
+    UI_i64 ticks = ui_time_now() - begin;
+    *widgets = ui.layout_count;
+    *tasks = ui_layout_pool.task_count;
+    ui.root = 0;
+    ui.current = 0;
+    ui_frame_arena_flip();
+    return ticks;
+}
+
+void ui_layout_benchmark(void) {
+    for (UI_u32 deep = 0; deep < 2; ++deep) {
+        UI_u32 widgets = 0;
+        UI_u32 tasks = 0;
+        /* The first build allocates the widgets */
+        ui_layout_benchmark_run(deep, FALSE, &widgets, &tasks);
+        UI_i64 serial = ui_layout_benchmark_run(deep, FALSE, &widgets, &tasks);
+        UI_i64 pooled = ui_layout_benchmark_run(deep, TRUE, &widgets, &tasks);
+        printf("layout 1000 %s: %u widgets, serial %.3f ms, pool %.3f ms (%u tasks, %u workers)\n",
+               deep ? "deep" : "wide", widgets, ui_time_seconds(serial)*1000.0, ui_time_seconds(pooled)*1000.0,
+               tasks, ui_layout_pool.worker_count);
+    }
+}
+#endif
+
+void main_loop(float dt) {
+    ui_push_rect(v2i(100, 100), v2i(100, 100), v4f(0.6f, 0.2f, 0.8f, 1.0f));
+
+    ui_begin_widget(UI_ID("root"));
+    for (int i = 0; i < 2; ++i) {
+        ui_begin_widget(ui_id_int(i));
+        ui_end_widget();
+    }
+    UI_Track columns[] = { {UI_TRACK_FIXED, 80.0f}, {UI_TRACK_AUTO, 0.0f}, {UI_TRACK_FRACTION, 1.0f} };
+    ui_grid_begin(UI_ID("grid"), columns, ARRAY_COUNT(columns), 0, 0, v2i(400, 0));
+    for (int i = 0; i < 9; ++i) {
+        ui_box(ui_id_int(i), v2i(20 + i*4, 20));
+    }
+    ui_grid_end();
     ui_end_widget();
 
     ui_update_and_render();
@@ -189,18 +1160,15 @@ void main_loop(float dt) {
 void ui_draw_draw_cmmd_buffer(HDC device_context) {
     glClearColor(0.12f, 0.1f, 0.15f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    for (UI_u64 i = 0; i < draw_cmmd_buffer_count; ++i) {
-        UI_DrawCmmd cmmd = draw_cmmd_buffer[i];
-        UI_RectMesh r = ui_rect_get_mesh(cmmd.pos, cmmd.dim);
-        glBegin(GL_TRIANGLES);
-        glColor3f(cmmd.color.x, cmmd.color.y, cmmd.color.z);
-        for (int index = 0; index < ARRAY_COUNT(r.t); ++index) {
-            glVertex3i(r.t[index].v[0].x, r.t[index].v[0].y, 0);
-            glVertex3i(r.t[index].v[1].x, r.t[index].v[1].y, 0);
-            glVertex3i(r.t[index].v[2].x, r.t[index].v[2].y, 0);
-        }
-        glEnd();
-    }
+    ui_quads_expand(draw_cmmd_buffer, draw_cmmd_buffer_count, 0,
+                    draw_vertex_buffer, draw_color_buffer, draw_index_buffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_INT, 0, draw_vertex_buffer);
+    glColorPointer(4, GL_FLOAT, 0, draw_color_buffer);
+    glDrawElements(GL_TRIANGLES, (GLsizei)(draw_cmmd_buffer_count*6), GL_UNSIGNED_INT, draw_index_buffer);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
     draw_cmmd_buffer_count = 0;
     SwapBuffers(device_context);
 }
@@ -253,6 +1221,12 @@ LRESULT CALLBACK ui_win32_proc(HWND window, UINT message, WPARAM wparam, LPARAM
             glOrtho(0, width, height, 0, 0, 1);
             glViewport(0, 0, width, height);
         } break;
+        case WM_MOUSEMOVE:
+        case WM_LBUTTONDOWN:
+        case WM_LBUTTONUP: {
+            ui_scheduler_input_event();
+            result = DefWindowProcA(window, message, wparam, lparam);
+        } break;
         case WM_PAINT: {
             float dt = 1.0f/60.0f;
             main_loop(dt);
@@ -295,13 +1269,18 @@ int main(void) {
     global_running = 1;
     ui_init();
     while (global_running) {
+        /* Late latch: sleep first so the input drained below is as fresh as possible */
+        ui_scheduler_wait();
         MSG message;
         while (PeekMessageA(&message, window, 0, 0, PM_REMOVE)) {
             TranslateMessage(&message);
             DispatchMessageA(&message);
         }
+        ui_scheduler_begin_build();
         main_loop(dt);
+        ui_scheduler_end_build();
         ui_draw_draw_cmmd_buffer(device_context);
+        ui_scheduler_present();
     }
     ui_quit();
     ReleaseDC(window, device_context);
@@ -7,6 +7,8 @@
 #include <assert.h>
 #include <Windows.h>
 #include <GL\gl.h>
+#include <intrin.h>
+#include <immintrin.h>
 
 #define TRUE 1
 #define FALSE 0
@@ -66,15 +68,8 @@ inline UI_V2i v2i_sub(UI_V2i a, UI_V2i b) {
     return result;
 }
 
-typedef struct UI_Triangle {
-    UI_V2i v[3];
-} UI_Triangle;
-
-typedef struct UI_RectMesh {
-    UI_Triangle t[2];
-} UI_RectMesh;
-
-
+/* Written in place with ui_draw_reserve and the ui_write_ functions in ui.c.
+   NOTE: pos and dim must stay the first 16 bytes, the SIMD quad kernels load them with one load */
 typedef struct UI_DrawCmmd {
     UI_V2i pos;
     UI_V2i dim;
@@ -85,6 +80,37 @@ typedef struct UI_DrawCmmd {
 typedef BOOL (WINAPI * PFNWGLSWAPINTERVALEXTPROC) (int interval);
 static PFNWGLSWAPINTERVALEXTPROC wglSwapIntervalEXT;
 
+/* Quad expansion kernel: every draw command becomes 4 vertices, 4 colors and 6 indices.
+   The best implementation for the running cpu is selected in ui_init */
+typedef void (* UI_QUADS_EXPAND_PROC) (UI_DrawCmmd *cmmds, UI_u64 count, UI_u32 base_vertex,
+                                       UI_V2i *vertices, UI_V4f *colors, UI_u32 *indices);
+static UI_QUADS_EXPAND_PROC ui_quads_expand;
+/* Checks every kernel against the scalar one and times them, from ui_init */
+#ifndef UI_QUADS_BENCHMARK
+#define UI_QUADS_BENCHMARK 0
+#endif
+
+/* Widget ids are 64 bit hashes mixed with the seed on top of the id stack */
+typedef UI_u64 UI_Id;
+
+#define UI_ID_STACK_MAX 4096 /* tree widgets push one id per nesting level */
+
+/* FNV-1a of a string literal as one expression, UI_ID("name") == ui_id_string("name"). An
+   optimized build folds it to a constant, the /Od build in build.bat evaluates it on every call
+   (64 unrolled steps, no loop over the string). Literals longer than 64 characters do not compile */
+#define UI__ID_C(s, i) ((i) < sizeof(s) - 1 ? (UI_u64)(UI_u8)(s)[(i) % sizeof(s)] : 0ull)
+#define UI__ID_P(s, i) ((i) < sizeof(s) - 1 ? 1099511628211ull : 1ull)
+#define UI__ID_1(s, i, h) (((h) ^ UI__ID_C(s, i)) * UI__ID_P(s, i))
+#define UI__ID_4(s, i, h) UI__ID_1(s, (i) + 3, UI__ID_1(s, (i) + 2, UI__ID_1(s, (i) + 1, UI__ID_1(s, i, h))))
+#define UI__ID_16(s, i, h) UI__ID_4(s, (i) + 12, UI__ID_4(s, (i) + 8, UI__ID_4(s, (i) + 4, UI__ID_4(s, i, h))))
+#define UI__ID_64(s, h) UI__ID_16(s, 48, UI__ID_16(s, 32, UI__ID_16(s, 16, UI__ID_16(s, 0, h))))
+#define UI_ID(s) ((UI_Id)(UI__ID_64(s, 14695981039346656037ull) + 0*sizeof(char[sizeof(s) <= 65 ? 1 : -1])))
+
+typedef struct UI_RegistrySlot {
+    UI_Id id;
+    void *value;
+} UI_RegistrySlot;
+
 typedef enum UI_Layout {
     WIDGET_LAYOUT_NONE,
     WIDGET_LAYOUT_COLUMN,
@@ -101,33 +127,180 @@ typedef enum UI_Flags {
     UI_ACTIVE_ANIMATION = (1 << 5),
 } UI_Flags;
 
+/* Grid tracks: fixed tracks are value pixels, auto tracks fit the largest cell and
+   fractional tracks split what the fixed and auto tracks leave of the grid size by weight */
+typedef enum UI_TrackSizing {
+    UI_TRACK_FIXED,
+    UI_TRACK_AUTO,
+    UI_TRACK_FRACTION,
+} UI_TrackSizing;
+
+typedef struct UI_Track {
+    UI_TrackSizing sizing;
+    UI_f32 value;
+} UI_Track;
+
+#define UI_GRID_TRACK_MAX 256 /* declared tracks, rows past the declared ones are auto */
+
+/* Prints the layout time of 1k, 10k and 100k cell grids from ui_init */
+#ifndef UI_GRID_BENCHMARK
+#define UI_GRID_BENCHMARK 0
+#endif
+
+typedef struct UI_GridCell {
+    UI_Id id;
+    UI_V2i dim;
+} UI_GridCell;
+
+/* Grid layout cache, children fill the cells in row-major order. A cell whose widget or
+   size changed only re-measures its row and column, the cells are placed again only when
+   a track moved */
+typedef struct UI_GridLayout {
+    UI_Track columns[UI_GRID_TRACK_MAX];
+    UI_Track rows[UI_GRID_TRACK_MAX];
+    UI_u32 column_count;
+    UI_u32 row_count;
+    UI_V2i available; /* size shared by the fractional tracks, 0 makes them auto */
+    /* Cache */
+    UI_GridCell *cells;
+    UI_u32 cell_count;
+    UI_u32 cell_capacity;
+    UI_u32 track_row_count; /* declared rows plus the implicit ones */
+    UI_u32 track_row_capacity;
+    UI_i32 *column_content; /* largest cell width of every column */
+    UI_i32 *row_content;
+    UI_i32 *column_offset;  /* column_count + 1 entries, the last one is the grid width */
+    UI_i32 *row_offset;
+    UI_u8 *column_dirty;
+    UI_u8 *row_dirty;
+    UI_b32 needs_measure; /* tracks changed, every cell is measured again even in an empty grid */
+    UI_b32 needs_place;
+} UI_GridLayout;
+
 typedef struct UI_Widget {
     /* Widget state */
-    void *id;
+    UI_Id id;
     UI_Flags flags;
     UI_Layout layout;
     UI_V2i dim;
+    UI_V2i pos; /* relative to the parent, set by the layout of the parent */
+    UI_GridLayout *grid;
     /* Widget hierarchy */
     struct UI_Widget *parent;
     struct UI_Widget *first;
     struct UI_Widget *last;
     struct UI_Widget *next;
     struct UI_Widget *prev;
-    /* register list */
-    struct UI_Widget *reglist_next;
+    /* Flattened tree, subtree of the widget is [layout_index, layout_index + layout_size) */
+    UI_u32 layout_index;
+    UI_u32 layout_size;
 } UI_Widget;
 
+/* Parallel layout: trees bigger than UI_LAYOUT_PARALLEL_MIN are split into subtrees of at
+   most UI_LAYOUT_TASK_GRAIN widgets measured by a work stealing pool */
+#define UI_LAYOUT_PARALLEL_MIN 4096
+#define UI_LAYOUT_TASK_GRAIN 1024
+#define UI_LAYOUT_WORKER_MAX 16
+/* Prints the layout time of a 1000 deep chain and of a 1000 wide fan-out from ui_init */
+#ifndef UI_LAYOUT_BENCHMARK
+#define UI_LAYOUT_BENCHMARK 0
+#endif
+
+typedef struct UI_LayoutTask {
+    UI_u32 begin;
+    UI_u32 end;
+} UI_LayoutTask;
+
+/* Every worker pops tasks from its own queue and steals from the others when it is empty */
+typedef struct UI_LayoutQueue {
+    volatile LONG next;
+    LONG end;
+    UI_u8 padding[56]; /* one queue per cache line */
+} UI_LayoutQueue;
+
+typedef struct UI_LayoutPool {
+    HANDLE semaphore;
+    HANDLE threads[UI_LAYOUT_WORKER_MAX];
+    UI_u32 worker_count;
+    volatile LONG running;
+    volatile LONG pending; /* tasks not finished */
+    volatile LONG done;    /* workers that finished the current dispatch */
+    UI_LayoutQueue queues[UI_LAYOUT_WORKER_MAX + 1]; /* the last queue belongs to the calling thread */
+    UI_LayoutTask *tasks; /* frame arena */
+    UI_u32 task_count;
+} UI_LayoutPool;
+
+/* Linear arena of malloc'd blocks. Reset gives every block back at once and keeps them for
+   the next round, so after warming up a frame does not allocate */
+#define UI_ARENA_BLOCK_SIZE (1024*1024)
+#define UI_ARENA_ALIGN 16
+/* Poisons released memory and prints the frame arena usage, only of the frames that set a new
+   maximum, a frame that stays under the high-water mark prints nothing */
+#ifndef UI_ARENA_DEBUG
+#define UI_ARENA_DEBUG 0
+#endif
+#define UI_ARENA_POISON 0xdd
+
+typedef struct UI_ArenaBlock {
+    struct UI_ArenaBlock *next;
+    UI_u64 size;
+    UI_u64 used;
+    UI_u64 padding; /* keeps the data that follows aligned */
+} UI_ArenaBlock;
+
+typedef struct UI_Arena {
+    UI_ArenaBlock *first;
+    UI_ArenaBlock *last;
+    UI_ArenaBlock *current;
+    UI_u64 used;       /* bytes handed out since the last reset */
+    UI_u64 high_water; /* most bytes handed out between two resets */
+} UI_Arena;
+
 typedef struct UI_Ctrl {
     void *temp;
 } UI_Ctrl;
 
+/* Frame scheduler: starts the frame as late as possible before the next present
+   and measures the latency from the oldest input event to the present */
+#define UI_LATENCY_BUCKET_COUNT 64 /* 1 ms per bucket, the last one collects everything above */
+
+typedef struct UI_FrameScheduler {
+    UI_i64 frequency;
+    UI_i64 last_present;
+    UI_f64 frame_period; /* seconds, measured between presents */
+    UI_f64 build_cost;   /* seconds, fast rise and slow decay of the measured build time */
+    UI_i64 build_begin;
+    UI_i64 pending_input; /* oldest input event not consumed by a frame, 0 if none */
+    UI_i64 frame_input;   /* oldest input event consumed by the frame being built */
+    UI_u64 latency_histogram[UI_LATENCY_BUCKET_COUNT];
+    UI_u64 latency_count;
+} UI_FrameScheduler;
+
 typedef struct UI_State {
-    void *hot;
-    void *active;
+    UI_Id hot;
+    UI_Id active;
 
     UI_Widget *root;
     UI_Widget *current;
-    UI_Widget *reglist; /* TODO: this can be a hash table */
+
+    /* Pre-order array of the current tree, in the frame arena */
+    UI_Widget **layout_nodes;
+    UI_u32 layout_count;
+    UI_u32 widget_count; /* widgets added to the tree this frame */
+
+    /* Frame data: memory pushed while building a frame stays valid until the end of the
+       next one, so the frame can still be drawn after ui_update_and_render */
+    UI_Arena frame_arenas[2];
+    UI_u32 frame_arena_index;
+    UI_u64 frame_high_water; /* most bytes a single frame pushed */
+    UI_u64 frame;
+
+    /* Ids */
+    UI_Id id_stack[UI_ID_STACK_MAX];
+    UI_u32 id_stack_count;
+    UI_RegistrySlot *registry;
+    UI_u64 registry_capacity;
+    UI_u64 registry_count;
 } UI_State;
 
 #endif /* UI_H */